@@ -10,19 +10,20 @@ uniform ivec3 chunkCoords;
 uniform mat4 view;
 uniform mat4 proj;
 
-const uint CHUNKSIZE = 32;
+// CHUNKSIZE and POS_BITS are defined by the engine when loading the shader
+const uint POS_MASK = (1u << POS_BITS) - 1u;
 const uint ATLASDIM = 16;
 const float AO_INTENSITY = 0.06;
 
 void main() {
-    uint x  = (pos_ao & 0x00003F);
-    uint y  = (pos_ao & 0x000FC0) >> 6;
-    uint z  = (pos_ao & 0x03F000) >> 12;
-    uint ao = (pos_ao & 0x3C0000) >> 18;
+    uint x  = pos_ao & POS_MASK;
+    uint y  = (pos_ao >> POS_BITS) & POS_MASK;
+    uint z  = (pos_ao >> (2u*POS_BITS)) & POS_MASK;
+    uint ao = (pos_ao >> (3u*POS_BITS)) & 0xFu;
     uint u = (texCoords & 0x00FF);
     uint v = (texCoords & 0xFF00) >> 8;
     
-    vec3 inPosition = vec3(x, y, z) + vec3(chunkCoords) * 32.0;
+    vec3 inPosition = vec3(x, y, z) + vec3(chunkCoords) * float(CHUNKSIZE);
     gl_Position = proj * view * vec4(inPosition, 1.0);
     fragColor = vec3(1, 1, 1) * (1 - ao * AO_INTENSITY);
     outTexCoord = vec2(u, v) / ATLASDIM;
@@ -0,0 +1,78 @@
+#pragma once
+#include "base.hpp"
+#include <coroutine>
+#include <exception>
+
+// Asynchronous file reads and writes for the world streaming
+// the requests made during a frame go out together in update, on io_uring on Linux and on the jobs otherwise
+// the coroutines waiting for them are resumed in a later update on the thread that calls it
+// so the render thread never waits for the disk
+namespace AsyncIO {
+    struct Request {
+        enum Op: u8 { READ, WRITE, READ_FILE, WRITE_FILE };
+        Op op;
+        i32 fd = -1;
+        u64 offset = 0;
+        string path;
+        // the buffer read into or written from
+        vector<u8> bytes;
+        // bytes transferred or a negative errno
+        i64 result = 0;
+        // bytes moved by the parts of a byte range request that finished, a short one is sent again for the rest
+        u64 transferred = 0;
+        bool finished = false;
+        std::coroutine_handle<> waiter;
+    };
+
+    // co_await gives back the finished request
+    struct Awaitable {
+        Request request;
+        inline bool await_ready() const { return request.finished; }
+        void await_suspend(std::coroutine_handle<> handle);
+        inline Request await_resume() { return std::move(request); }
+    };
+
+    // a coroutine that starts right away and frees itself when it ends
+    struct Task {
+        struct promise_type {
+            inline Task get_return_object() { return {}; }
+            inline std::suspend_never initial_suspend() { return {}; }
+            inline std::suspend_never final_suspend() noexcept { return {}; }
+            inline void return_void() {}
+            inline void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    struct Stats {
+        u64 requests = 0;
+        // updates that sent at least one request
+        u64 batches = 0;
+        u64 bytesRead = 0;
+        u64 bytesWritten = 0;
+        u64 errors = 0;
+        u32 inFlight = 0;
+        bool uring = false;
+    };
+    extern Stats stats;
+
+    // the jobs do the requests when io_uring is not wanted or not available
+    void init(bool useUring = true, u32 depth = 256);
+    // waits for the requests in flight
+    void destroy();
+    // sends the queued requests and resumes the coroutines of the finished ones
+    void update();
+    bool idle();
+    // updates until every request finished, not for the render thread
+    void drain();
+
+    // files stay open for the byte range requests, -1 if it cannot be opened
+    i32 openFile(const string& path, bool write);
+    void closeFile(i32 fd);
+    Awaitable read(i32 fd, u64 offset, u32 size);
+    Awaitable write(i32 fd, u64 offset, vector<u8> bytes);
+    // whole files by path, they are opened and closed on the jobs
+    Awaitable readFile(const string& path);
+    Awaitable writeFile(const string& path, vector<u8> bytes);
+    // an awaitable that does not suspend, for data that is already in memory
+    Awaitable completed(vector<u8> bytes);
+};
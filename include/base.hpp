@@ -54,6 +54,10 @@ using glm::ivec4;
 vector<u8> readFileBytes(const char* filename);
 string readFileString(const char* filename);
 bool fileExists(const char* filename);
+// false if the file can't be opened or written completely
+bool writeFileBytes(const char* filename, const u8* bytes, u64 size);
+// creates the folder and its parents, true if it already exists
+bool makeFolder(const char* name);
 
 struct FileEntry {
     bool isDir;
@@ -61,5 +65,6 @@ struct FileEntry {
     bool hasExtension(const string& extension) const;
     void removeExtension(u32 extensionSize);
 };
+// sorted by name, so everything registered from a folder gets the same ids on every machine
 vector<FileEntry> readFolder(const char* name);
 vector<FileEntry> readFolderRecursively(const char* name);
\ No newline at end of file
@@ -17,8 +17,14 @@ extern ivec3 directionVector[DIRECTION_COUNT];
 extern const char* directionNames[DIRECTION_COUNT];
 extern ivec2 directionToAxisAndSign[DIRECTION_COUNT];
 
+// side of the cubic chunks, set at compile time with CHUNK_SIZE
+#ifndef CHUNK_SIZE
+    #define CHUNK_SIZE 32
+#endif
+
 struct DataEntry;
-struct Chunk;
+template<u32 SIZE> struct ChunkT;
+typedef ChunkT<CHUNK_SIZE> Chunk;
 struct VoxelMesh;
 
 struct BlockModel {
@@ -59,4 +65,37 @@ struct Block {
     // enums are defined in data
     string name;
     Block(string blockName, DataEntry* de);
+};
+
+// a property of a block whose value is one of the values of an enum
+struct BlockProperty {
+    string name;
+    vector<string> values;
+    u8 shift;
+    u8 bits;
+};
+
+// a block with all of its states, the states of a block have consecutive ids
+// and the property values are packed in the bits of (state - baseState)
+// so changing a property is a couple of bit operations instead of a name lookup
+// a block has 1 << (sum of the property bits) states, the combinations with
+// out of range values point to the default state
+struct BlockType {
+    string name;
+    u16 baseState;
+    u16 stateCount;
+    vector<BlockProperty> properties;
+
+    inline u32 getProperty(u16 state, u32 property) const {
+        const BlockProperty& prop = properties[property];
+        return ((state - baseState) >> prop.shift) & ((1u << prop.bits) - 1);
+    }
+    inline u16 withProperty(u16 state, u32 property, u32 value) const {
+        const BlockProperty& prop = properties[property];
+        u32 mask = ((1u << prop.bits) - 1) << prop.shift;
+        return baseState + (((state - baseState) & ~mask) | ((value << prop.shift) & mask));
+    }
+    // -1 if the block has no such property
+    i32 propertyIndex(const string& propName) const;
+    i32 valueIndex(u32 property, const string& value) const;
 };
\ No newline at end of file
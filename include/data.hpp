@@ -51,6 +51,8 @@ struct DataEntry {
     DataEntry(Type t);
     ~DataEntry();
     DataEntry* copy() const;
+    // deletes the entry with the children of its lists and maps, the destructor leaves those alone
+    static void deleteTree(DataEntry* de);
     static map<string, u8> enums;
 
     static DataEntry* readFile(const string& filename);
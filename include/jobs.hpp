@@ -0,0 +1,53 @@
+#pragma once
+#include "base.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// Work stealing job system shared by every subsystem
+// each worker thread has its own deque, it runs its newest jobs from the back
+// and idle workers steal the oldest jobs of the others from the front
+// jobs submitted from outside the workers go to a shared queue
+// a job runs once every job it depends on is done, jobs that need the GL context go to the main queue
+namespace Jobs {
+    struct JobData;
+    typedef std::shared_ptr<JobData> Job;
+
+    // timing of the jobs with the same name
+    struct TaskStats {
+        u64 count = 0;
+        f64 totalSeconds = 0;
+        f64 maxSeconds = 0;
+    };
+
+    // 0 threads uses every core but the main one, at least one
+    void init(u32 threads = 0);
+    void destroy();
+    u32 threadCount();
+
+    // the name groups the timings, it has to outlive the job
+    Job create(const char* name, std::function<void()> f);
+    // job starts after dependency finished, call before submitting job
+    void dependsOn(const Job& job, const Job& dependency);
+    void submit(const Job& job);
+    // create and submit
+    Job run(const char* name, std::function<void()> f);
+    bool finished(const Job& job);
+    // runs other jobs while waiting
+    void wait(const Job& job);
+    // runs one queued job on the calling thread, false if there was none
+    bool help();
+
+    // f(i) for every i below count in batches of grain indices, returns once all are done
+    // the calling thread runs batches too but no other jobs, so it is not held up by unrelated work
+    void parallelFor(const char* name, u32 count, u32 grain, const std::function<void(u32)>& f);
+
+    // for work that needs the GL context, runs in runMainQueue
+    void runOnMain(const char* name, std::function<void()> f);
+    // call from the main thread, returns the number of jobs run
+    u32 runMainQueue();
+
+    map<string, TaskStats> stats();
+    void logStats();
+};
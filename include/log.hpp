@@ -0,0 +1,38 @@
+#pragma once
+#include "base.hpp"
+#include <fstream>
+
+namespace Log {
+    extern std::ofstream logfile;
+    #ifdef WINDOWS
+        constexpr const char* endline = "\r\n";
+    #else
+        constexpr const char* endline = "\n";
+    #endif
+    void init();
+    void changeColor(u8 color);
+    void resetColor();
+    struct logger {
+        const u8 color;
+        const char* prefix;
+        const bool shouldExit;
+        template<typename... Ts>
+        inline const logger& operator()(Ts... args) const {
+            changeColor(color);
+            cerr << prefix;
+            resetColor();
+            cerr << ": "; 
+            (cerr << ... << args);
+            cerr << endline;
+            logfile << prefix << ": ";
+            (logfile << ... << args);
+            logfile << endline;
+            if(shouldExit) exit(1);
+            return *this;
+        }
+    };
+    extern const logger fatal;
+    extern const logger error;
+    extern const logger warning;
+    extern const logger info;
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include "base.hpp"
+
+// Simplex noise evaluated over arrays of points
+// the points go through the kernels 8 at a time with AVX2, 4 with SSE2 and one by one otherwise
+// every function returns values roughly in [-1, 1]
+namespace Noise {
+    // points per kernel call of the compiled instruction set
+    extern const u32 LANES;
+    extern const char* const INSTRUCTION_SET;
+
+    struct Fractal {
+        u32 octaves = 4;
+        // of the first octave
+        f32 frequency = 1.0f/64.0f;
+        // frequency multiplier between octaves
+        f32 lacunarity = 2.0f;
+        // amplitude multiplier between octaves
+        f32 gain = 0.5f;
+    };
+
+    void simplex2(const f32* x, const f32* y, f32* out, u32 count, u32 seed);
+    void simplex3(const f32* x, const f32* y, const f32* z, f32* out, u32 count, u32 seed);
+    // fractal brownian motion, octaves of simplex noise summed and normalized
+    void fbm2(const f32* x, const f32* y, f32* out, u32 count, u32 seed, const Fractal& fractal);
+    void fbm3(const f32* x, const f32* y, const f32* z, f32* out, u32 count, u32 seed, const Fractal& fractal);
+    // the points are moved by two fbm fields (scaled by warpAmount) before fractal is evaluated at them
+    void warpedFbm2(const f32* x, const f32* y, f32* out, u32 count, u32 seed, const Fractal& fractal, const Fractal& warp, f32 warpAmount);
+};
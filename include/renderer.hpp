@@ -18,6 +18,7 @@ namespace gl {
     void updateEBO(u32 EBO, const vector<u32>& values);
     u32 generateVAO();
     void addAttribToVAO(u32 index, i32 size, u32 type, i32 stride, u32 offset);
+    void bindVAO(u32 VAO);
     void drawVAO(u32 VAO, u32 count);
 
     u32 textureFromFile(const char* filename, u32 channels = 4);
@@ -65,29 +66,31 @@ extern Camera camera;
 
 // Simple Shader Implementation
 
-template<typename VertexT>
+// MeshT is the mesh type itself, it has addAttribs and updateUniforms
+// there are no virtual functions, so the meshes can be built by code that links without GL
+template<typename VertexT, typename MeshT>
 struct Mesh {
     vector<VertexT> vertices;
     vector<u32> indices;
     u32 indicesCount = 0;
-    u32 VAO, VBO, EBO;
-
-    virtual void addAttribs() = 0;
-    virtual void updateUniforms() = 0;
+    u32 VAO = 0, VBO = 0, EBO = 0;
+    // the GL objects are reused when the mesh is rebuilt
+    bool hasObjects = false;
 
     void makeObjects() {
         using namespace gl;
-        if(indicesCount != 0) {
-            indicesCount = indices.size();
+        indicesCount = indices.size();
+        if(hasObjects) {
+            bindVAO(VAO);
             updateVBO(VBO, vertices.data(), vertices.size()*sizeof(*vertices.data()));
             updateEBO(EBO, indices);
         }
         else {
-            indicesCount = indices.size();
             VBO = generateVBO(vertices.data(), vertices.size()*sizeof(*vertices.data()));
             VAO = generateVAO();
-            this->addAttribs();
+            static_cast<MeshT*>(this)->addAttribs();
             EBO = generateEBO(indices);
+            hasObjects = true;
         }
         indices.clear(); indices.shrink_to_fit();
         vertices.clear(); vertices.shrink_to_fit();
@@ -104,12 +107,12 @@ struct SimpleVertex {
     vec2 texCoords;
 };
 
-struct SimpleMesh : Mesh<SimpleVertex> {
+struct SimpleMesh : Mesh<SimpleVertex, SimpleMesh> {
 
     mat4 modelMatrix = mat4(1);
 
-    virtual void addAttribs();
-    virtual void updateUniforms();
+    void addAttribs();
+    void updateUniforms();
 
 };
 
@@ -120,11 +123,11 @@ struct VoxelVertex {
     u32 texCoords;
 };
 
-struct VoxelMesh : Mesh<VoxelVertex> {
+struct VoxelMesh : Mesh<VoxelVertex, VoxelMesh> {
 
     ivec3 chunkCoords;
 
-    virtual void addAttribs();
-    virtual void updateUniforms();
+    void addAttribs();
+    void updateUniforms();
 
 };
\ No newline at end of file
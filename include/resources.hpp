@@ -62,7 +62,11 @@ namespace Registry {
     extern registry<TextureRI> textures;
 
     extern registry<BlockModelRI> blockModels;
+    // indexed by block state, the names are "block/prop_value/..."
     extern registry<Block*> blocks;
+    extern registry<BlockType> blockTypes;
+    // the index in blockTypes of every block state
+    extern vector<u16> blockStateTypes;
     extern registry<EntityModelRI> entityModels;
     extern registry<EntityType> entities;
 
@@ -70,7 +74,24 @@ namespace Registry {
     constexpr u32 ATLASTILE = 16;
     u32* makeAtlas(); // Creates a texture atlas with all the files within the folder 
     void addToAtlas(u32* atlasData, u32& index, const string& folder);
+    // finishAtlas and makeGLTextures are in resourcesgl.cpp
     GLTexture finishAtlas(u32* atlasData);
     void makeGLTextures(const string& folder);
+    // the name of every block state by state id, the world saves it to map the ids of its chunks
+    // the unused states that fill up the property bits of a block type have empty names
+    vector<string> blockStateNames();
+    inline const BlockType& blockTypeOf(u16 state) { return blockTypes.items[blockStateTypes[state]]; }
+    // the state with the property changed, a table lookup and some bit operations
+    inline u16 withProperty(u16 state, u32 property, u32 value) { return blockTypeOf(state).withProperty(state, property, value); }
+    inline u32 getProperty(u16 state, u32 property) { return blockTypeOf(state).getProperty(state, property); }
+    // the steps of init that do not need a GL context
+    void registerEnums();
+    void registerTextures();
+    void registerBlockModels();
+    void registerBlocks();
+    void registerEntities();
+    // in resourcesgl.cpp, compiles the shaders and uploads the textures
     void init();
+    // registers the enums, textures and blocks without a GL context, nothing is uploaded
+    void initHeadless();
 };
\ No newline at end of file
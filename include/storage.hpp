@@ -0,0 +1,140 @@
+#pragma once
+#include "base.hpp"
+#include "asyncio.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include <glm/ext/vector_int2.hpp>
+#include <glm/ext/vector_int3.hpp>
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include "glm/gtx/hash.hpp"
+
+// How the bytes of a chunk in a region file are stored
+enum RegionCompression: u8 {
+    // ChunkT::serialize of an unpacked chunk
+    COMPRESSION_NONE,
+    // ChunkT::serialize of a chunk packed into runs of equal words
+    COMPRESSION_PACKED,
+    COMPRESSION_COUNT
+};
+
+// The chunks of COLUMNS x COLUMNS chunk columns in one file
+// a header with an entry per chunk is followed by sectors, every chunk takes whole sectors
+// a chunk that is saved again goes to the first free run of sectors or to the end of the file,
+// its old sectors are only freed once the new bytes and the entry pointing at them are on disk
+// the file is also mapped read only so the saved chunks can be decoded where they are
+struct RegionFile {
+    static constexpr u32 SECTOR = 4096;
+    static constexpr u32 COLUMNS = 32;
+    static constexpr u32 MAGIC = 0x314e4752; // "RGN1"
+    struct Entry {
+        // first sector, 0 when the chunk was never saved
+        u32 sector;
+        u32 length;
+        // seconds since the epoch when it was written
+        u32 timestamp;
+        RegionCompression compression;
+        u8 padding[3];
+    };
+    static_assert(sizeof(Entry) == 16, "region entries are written as they are");
+    i32 fd = -1;
+    // chunks in a column
+    u32 rows = 0;
+    u32 headerSectors = 0;
+    vector<Entry> entries;
+    // sectors taken by the header and the chunks
+    vector<bool> used;
+    // nullptr until the first chunk is viewed
+    const u8* mapped = nullptr;
+    u64 mappedSize = 0;
+
+    static inline ivec2 regionOf(ivec3 coords) { return { coords.x >> 5, coords.z >> 5 }; }
+    // -1 for rows outside the region
+    inline i32 indexOf(ivec3 coords, i32 firstRow) const {
+        i32 y = coords.y - firstRow;
+        if(y < 0 || y >= (i32)rows)
+            return -1;
+        return (coords.x & (COLUMNS-1)) + ((coords.z & (COLUMNS-1)) + y*COLUMNS)*COLUMNS;
+    }
+    // reads the header of an existing file, or writes an empty one into a new file
+    bool open(const string& path, u32 rows);
+    void close();
+    // takes a free run of sectors for length bytes, the entries still point at the old ones
+    u32 allocate(u32 length);
+    // gives back the sectors of a write that failed
+    void release(u32 sector, u32 length);
+    // points the entry at its new sectors and frees the old ones, once both are written
+    void commit(u32 index, const Entry& entry);
+    inline u64 entryOffset(u32 index) const { return 16 + (u64)index*sizeof(Entry); }
+    // the saved bytes of a chunk in the mapping, nullptr if it was never saved or the file cannot be mapped
+    // the mapping grows with the file, which moves it, so the pointer is only good until the next view
+    const u8* view(u32 index);
+    // whether every page of the chunk in the mapping is in memory, reading it then never waits for the disk
+    bool resident(u32 index) const;
+    // asks the kernel to start reading the sectors of these chunks into the page cache
+    void prefetch(const vector<u32>& indices);
+    // bytes of the file in use
+    inline u64 usedBytes() const { return (u64)std::count(used.begin(), used.end(), true)*SECTOR; }
+};
+
+// The chunks of a world on disk, a folder with a world.td file and the region files
+// region files are opened on first use and stay open, a missing one reads as chunks that were never saved
+// the world loads and saves chunks asynchronously, the tools use the blocking calls
+struct WorldStorage {
+    // a chunk handed to saveChunk that is not on disk yet
+    struct PendingWrite {
+        vector<u8> bytes;
+        RegionCompression compression;
+        // saved again while the write was in flight, it is written once more
+        bool dirty;
+        // the write failed, the bytes stay here until the chunk is saved again
+        bool failed;
+    };
+    // empty while no folder is open
+    string folder;
+    // chunk y coordinates in every column
+    ivec2 rows;
+    // totals of the chunks read and written
+    u64 bytesRead = 0;
+    u64 bytesWritten = 0;
+    // nullptr for regions without a file
+    std::unordered_map<ivec2, RegionFile*> regions;
+    // loads of these chunks get the bytes from here instead of the disk
+    std::unordered_map<ivec3, PendingWrite> writing;
+
+    // creates the folder if needed
+    bool open(const string& folder, ivec2 rows);
+    inline bool isOpen() const { return !folder.empty(); }
+    // closes the region files, wait for the writes first
+    void close();
+    // the generation settings of the world and the block state names its chunks are saved with, by saved id
+    bool writeInfo(u64 seed, const vector<string>& states);
+    inline bool hasInfo() const { return fileExists((folder + "/world.td").c_str()); }
+    // false and an error when world.td is missing or cannot be read, states is empty for worlds saved without them
+    bool readInfo(u64& seed, vector<string>& states) const;
+    bool writeChunk(ivec3 coords, const vector<u8>& bytes, RegionCompression compression);
+    // false if the chunk was never saved
+    bool readChunk(ivec3 coords, vector<u8>& out);
+    // co_await gives the bytes of the chunk, none if it was never saved
+    AsyncIO::Awaitable loadChunk(ivec3 coords);
+    // returns right away, one write per chunk is in flight at a time
+    void saveChunk(ivec3 coords, vector<u8> bytes, RegionCompression compression);
+    // true while the last save of the chunk failed, it has to be saved again even if it did not change
+    inline bool unsaved(ivec3 coords) const {
+        auto it = writing.find(coords);
+        return it != writing.end() && it->second.failed;
+    }
+    // writes the chunks whose save failed once more, for the chunks that are not loaded anymore
+    void retryFailed();
+    // the saved bytes of a chunk in its mapped region file, nullptr when it has to be read with loadChunk
+    // because it is not mapped or its pages are not in memory yet
+    // only good until the next call that views a chunk of the same region
+    const u8* mappedChunk(ivec3 coords, u32& size);
+    // hints the saved chunks of the columns within radius of column, so they are in memory when they get loaded
+    void prefetch(ivec2 column, i32 radius);
+    // nullptr if the region has no file and create is not set
+    RegionFile* region(ivec3 coords, bool create);
+    string regionPath(ivec2 region) const;
+private:
+    AsyncIO::Task writeChunkData(ivec3 coords);
+};
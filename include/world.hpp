@@ -1,8 +1,15 @@
 #pragma once
+#include "asyncio.hpp"
 #include "data.hpp"
 #include "entity.hpp"
 #include "renderer.hpp"
+#include "storage.hpp"
+#include "worldgen.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cstdlib>
+#include <functional>
 #include <glm/ext/vector_int3.hpp>
 #include <unordered_map>
 #define GLM_ENABLE_EXPERIMENTAL
@@ -10,47 +17,758 @@
 
 struct VoxelMesh;
 
-struct Chunk {
-    static constexpr u32 CHUNKSIZE = 32;
-    typedef u8 blockID; 
-    blockID blocks[CHUNKSIZE*CHUNKSIZE*CHUNKSIZE];
-    u16 lightlevels[CHUNKSIZE*CHUNKSIZE*CHUNKSIZE];
+// Fixed size array of u16 values stored as indices into a palette
+// uses 1, 2, 4 or 8 bits per value, at 16 bits the values are stored directly
+// the entries never cross a u64 word, so reading is a shift and a mask
+// with 0 bits the array is uniform: it holds a single value and no data
+struct PalettedArray {
+    u32 count;
+    u8 bits;
+    u8 bitsLog2;
+    // 0 when uniform so that every index reads the first bit of data
+    u32 indexMask;
+    vector<u16> palette;
+    vector<u64> data;
+    // runs of equal words of data while the array is packed, data is empty meanwhile
+    vector<u8> packed;
+
+    PalettedArray(u32 count, u16 value = 0);
+
+    inline bool isUniform() const { return bits == 0; }
+    inline bool isPacked() const { return !packed.empty(); }
+    // reads of a packed array decode the word in place, code that reads a lot should unpack first
+    inline u16 get(u32 index) const {
+        u32 bit = (index << bitsLog2) & indexMask;
+        u64 word = isPacked() ? packedWord(bit >> 6) : data[bit >> 6];
+        u64 v = (word >> (bit & 63)) & ((1ull << bits) - 1);
+        return bits == 16 ? (u16)v : palette[v];
+    }
+    inline void setRaw(u32 index, u64 v) {
+        u32 bit = index << bitsLog2;
+        data[bit >> 6] = (data[bit >> 6] & ~(((1ull << bits) - 1) << (bit & 63))) | (v << (bit & 63));
+    }
+    void set(u32 index, u16 value);
+    // makes the array uniform
+    void fill(u16 value);
+    // scans the data and turns the array uniform if all the values are equal
+    bool makeUniform();
+    // drops unused palette entries and shrinks the bit width if possible
+    void repack();
+    // compresses data into runs of equal words, false if the array is uniform or it would not save memory
+    bool pack();
+    // restores data, the writes do it on their own
+    void unpack();
+    // size of data when unpacked
+    inline u32 unpackedSize() const { return ((u64)count*bits+63)/64*sizeof(u64); }
+    u32 memoryUsage() const;
+    // replaces every value v with values[v], false if some value is not in values
+    bool remap(const vector<u16>& values);
+    // appends the array to out, packed arrays stay packed
+    void serialize(vector<u8>& out) const;
+    // reads an array written by serialize and moves in past it, false if the bytes are not a valid array
+    bool deserialize(const u8*& in, const u8* end);
+private:
+    // the word of data with that index, walks the packed tokens
+    u64 packedWord(u32 word) const;
+    u32 paletteIndex(u16 value);
+    void resize(u8 newBitsLog2);
+};
+
+// Orders of the voxels inside a chunk, one is picked at compile time with CHUNK_LAYOUT
+// indexOf maps in chunk coordinates to the storage index and posOf does the opposite
+// forEach calls f(pos, index) for every voxel in storage order
+namespace ChunkLayout {
+    // x is contiguous, then z, then y
+    template<u32 S> struct XZY {
+        static constexpr const char* name = "XZY";
+        static inline u32 indexOf(ivec3 p) { return p.x + (p.z + p.y*S)*S; }
+        static inline ivec3 posOf(u32 i) { return { i%S, i/(S*S), (i/S)%S }; }
+        template<typename F> static inline void forEach(F f) {
+            u32 i = 0;
+            for(u32 y=0; y<S; y++) for(u32 z=0; z<S; z++) for(u32 x=0; x<S; x++, i++)
+                f(ivec3(x, y, z), i);
+        }
+    };
+
+    // y is contiguous, then z, then x, so columns are continuous in memory
+    template<u32 S> struct YZX {
+        static constexpr const char* name = "YZX";
+        static inline u32 indexOf(ivec3 p) { return p.y + (p.z + p.x*S)*S; }
+        static inline ivec3 posOf(u32 i) { return { i/(S*S), i%S, (i/S)%S }; }
+        template<typename F> static inline void forEach(F f) {
+            u32 i = 0;
+            for(u32 x=0; x<S; x++) for(u32 z=0; z<S; z++) for(u32 y=0; y<S; y++, i++)
+                f(ivec3(x, y, z), i);
+        }
+    };
+
+    // Z-order curve, bits of x, z and y interleaved
+    template<u32 S> struct MORTON {
+        static constexpr const char* name = "MORTON";
+        static inline u32 spread(u32 v) {
+            v = (v | (v << 16)) & 0x030000FF;
+            v = (v | (v <<  8)) & 0x0300F00F;
+            v = (v | (v <<  4)) & 0x030C30C3;
+            v = (v | (v <<  2)) & 0x09249249;
+            return v;
+        }
+        static inline u32 compact(u32 v) {
+            v &= 0x09249249;
+            v = (v ^ (v >>  2)) & 0x030C30C3;
+            v = (v ^ (v >>  4)) & 0x0300F00F;
+            v = (v ^ (v >>  8)) & 0xFF0000FF;
+            v = (v ^ (v >> 16)) & 0x000003FF;
+            return v;
+        }
+        static inline u32 indexOf(ivec3 p) { return spread(p.x) | (spread(p.z) << 1) | (spread(p.y) << 2); }
+        static inline ivec3 posOf(u32 i) { return { compact(i), compact(i >> 2), compact(i >> 1) }; }
+        template<typename F> static inline void forEach(F f) {
+            for(u32 i=0; i<S*S*S; i++)
+                f(ivec3(compact(i), compact(i >> 2), compact(i >> 1)), i);
+        }
+    };
+
+    // 4x4x4 bricks, each one XZY inside and the bricks XZY in the chunk
+    template<u32 S> struct BRICKS {
+        static constexpr const char* name = "BRICKS";
+        static constexpr u32 B = S/4;
+        static inline u32 indexOf(ivec3 p) {
+            u32 brick = (p.x >> 2) + ((p.z >> 2) + (p.y >> 2)*B)*B;
+            return brick*64 + (p.x & 3) + (p.z & 3)*4 + (p.y & 3)*16;
+        }
+        static inline ivec3 posOf(u32 i) {
+            u32 brick = i >> 6;
+            return { (brick%B)*4 + (i & 3), (brick/(B*B))*4 + ((i >> 4) & 3), ((brick/B)%B)*4 + ((i >> 2) & 3) };
+        }
+        template<typename F> static inline void forEach(F f) {
+            u32 i = 0;
+            for(u32 by=0; by<S; by+=4) for(u32 bz=0; bz<S; bz+=4) for(u32 bx=0; bx<S; bx+=4)
+            for(u32 y=by; y<by+4; y++) for(u32 z=bz; z<bz+4; z++) for(u32 x=bx; x<bx+4; x++, i++)
+                f(ivec3(x, y, z), i);
+        }
+    };
+};
+
+#ifndef CHUNK_LAYOUT
+    #define CHUNK_LAYOUT XZY
+#endif
+
+template<u32 SIZE>
+struct ChunkT {
+    static constexpr u32 CHUNKSIZE = SIZE;
+    static constexpr u32 VOLUME = CHUNKSIZE*CHUNKSIZE*CHUNKSIZE;
+    // bits per coordinate in VoxelVertex::pos_ao, vertices go from 0 to CHUNKSIZE inclusive
+    static constexpr u32 POS_BITS = std::bit_width(CHUNKSIZE);
+    static constexpr u32 POS_MASK = (1u << POS_BITS) - 1;
+    static constexpr u32 SIZE_LOG2 = std::countr_zero(CHUNKSIZE);
+    static_assert(3*POS_BITS + 4 <= 32, "chunk too big for the vertex packing");
+    static_assert(std::has_single_bit(CHUNKSIZE) && CHUNKSIZE >= 4, "chunk size must be a power of 2");
+    typedef ChunkLayout::CHUNK_LAYOUT<CHUNKSIZE> Layout;
+    typedef u16 blockID;
+    PalettedArray blocks;
+    PalettedArray lightlevels;
+
+    // occupancy of the non air blocks, kept in sync by setBlock and fill
+    // a bit per 4x4x4 brick and a 64 bit set for the voxels of every brick
+    static constexpr u32 BRICKS = CHUNKSIZE/4;
+    static constexpr u32 BRICK_COUNT = BRICKS*BRICKS*BRICKS;
+    u64 brickMask[(BRICK_COUNT+63)/64];
+    // empty while no brick is occupied
+    vector<u64> brickVoxels;
+    u32 occupiedBricks;
+    // bumped by every change so that idle chunks can be found
+    u32 revision;
+
+    ChunkT() : blocks(VOLUME), lightlevels(VOLUME), brickMask(), brickVoxels(), occupiedBricks(0), revision(0) {}
+    inline blockID getBlock(u32 index) const { return blocks.get(index); }
+    inline void setBlock(u32 index, blockID block) { 
+        blocks.set(index, block); 
+        revision++;
+        setOccupied(Layout::posOf(index), block != 0); 
+    }
+    void fill(blockID block);
+
+    static inline u32 brickOf(ivec3 inChunkCoords) { return (inChunkCoords.x >> 2) + ((inChunkCoords.z >> 2) + (inChunkCoords.y >> 2)*BRICKS)*BRICKS; }
+    static inline u32 brickBitOf(ivec3 inChunkCoords) { return (inChunkCoords.x & 3) + (inChunkCoords.z & 3)*4 + (inChunkCoords.y & 3)*16; }
+    inline bool isEmpty() const { return occupiedBricks == 0; }
+    inline bool isBrickOccupied(u32 brick) const { return (brickMask[brick >> 6] >> (brick & 63)) & 1; }
+    inline bool isOccupied(ivec3 inChunkCoords) const {
+        return !brickVoxels.empty() && ((brickVoxels[brickOf(inChunkCoords)] >> brickBitOf(inChunkCoords)) & 1);
+    }
+    void setOccupied(ivec3 inChunkCoords, bool occupied) {
+        u32 brick = brickOf(inChunkCoords);
+        u64 bit = 1ull << brickBitOf(inChunkCoords);
+        if(occupied) {
+            if(brickVoxels.empty())
+                brickVoxels.assign(BRICK_COUNT, 0);
+            if(brickVoxels[brick] == 0) {
+                brickMask[brick >> 6] |= 1ull << (brick & 63);
+                occupiedBricks++;
+            }
+            brickVoxels[brick] |= bit;
+        }
+        else if(!brickVoxels.empty() && (brickVoxels[brick] & bit)) {
+            brickVoxels[brick] &= ~bit;
+            if(brickVoxels[brick] == 0) {
+                brickMask[brick >> 6] &= ~(1ull << (brick & 63));
+                if(--occupiedBricks == 0) {
+                    brickVoxels.clear();
+                    brickVoxels.shrink_to_fit();
+                }
+            }
+        }
+    }
+    inline u16 getLight(u32 index) const { return lightlevels.get(index); }
+    inline void setLight(u32 index, u16 light) { lightlevels.set(index, light); revision++; }
+    inline bool isUniform() const { return blocks.isUniform(); }
+    // shrinks the storage after generation or a batch of edits
+    void compact();
+    // compresses the block and light data, the writes unpack them again, the reads decode them in place
+    inline bool pack() { bool packedBlocks = blocks.pack(); return lightlevels.pack() || packedBlocks; }
+    inline void unpack() { blocks.unpack(); lightlevels.unpack(); }
+    inline bool isPacked() const { return blocks.isPacked() || lightlevels.isPacked(); }
+    u32 memoryUsage() const;
+    // the blocks and the light, states maps the state ids of the registry to the saved ones
+    void serialize(vector<u8>& out, const vector<u16>* states = nullptr) const;
+    // false if the data is invalid, the chunk is left empty then, states maps the saved ids to the registry
+    bool deserialize(const u8* data, u64 size, const vector<u16>* states = nullptr);
 
-    void makeSin(ivec3 coords);
     void makeRandom();
 
-    static u32 indexOf(ivec3 inChunkCoords);
+    static inline u32 indexOf(ivec3 inChunkCoords) { return Layout::indexOf(inChunkCoords); }
     static bool inBounds(ivec3 inChunkCoords);
     //void makeSimpleMesh(SimpleMesh& mesh);
-    void makeVoxelMesh(VoxelMesh& mesh, Chunk* neighbours[6]) const;
+    void makeVoxelMesh(VoxelMesh& mesh, ChunkT* neighbours[6]) const;
+};
+
+// Stages of a chunk in the ChunkPipeline, in order
+enum ChunkStage: u8 {
+    STAGE_EMPTY,
+    STAGE_TERRAIN,
+    STAGE_FEATURES,
+    STAGE_LIT,
+    STAGE_MESHED,
+    STAGE_UPLOADED,
+    STAGE_COUNT
 };
+extern const char* chunkStageNames[STAGE_COUNT];
 
-struct WorldChunk {
+// How much of the game runs in a chunk, from the most to the least
+enum LoadLevel: u8 {
+    // the entities move and collide
+    LEVEL_ENTITY_TICKING,
+    // the blocks are simulated but the entities stand still
+    LEVEL_TICKING,
+    // only drawn
+    LEVEL_RENDER,
+    LEVEL_UNLOADED,
+    LEVEL_COUNT
+};
+extern const char* loadLevelNames[LEVEL_COUNT];
+
+template<u32 SIZE>
+struct WorldChunkT {
     ivec3 coords;
-    Chunk chunk;
+    ChunkT<SIZE> chunk;
     // TODO: consider moving this to the the world
     std::unordered_map<UUID, Entity*> entities;
     bool needsRemeshing;
     VoxelMesh mesh;
+    // kept up to date by the ChunkGrid, nullptr when not loaded
+    WorldChunkT* neighbours[DIRECTION_COUNT];
+    // position in ChunkGrid::loaded
+    u32 gridIndex;
+    // used by the ChunkCompactor, the revision of the chunk when it was last seen changing
+    u32 idleRevision;
+    f32 idleSince;
+    bool compacted;
+    ChunkStage stage;
+    // directions without a neighbour when the mesh was made
+    u8 missingNeighbours;
+    // from ChunkFocus::cost, the pipeline works on the cheapest chunks first
+    f32 cost;
+    // when the chunk was added to the pipeline, for the time it takes to become visible
+    f64 requestedAt;
+    // from the tickets, updated by the ChunkStreamer
+    LoadLevel level;
+    // being read from the WorldStorage, it cannot be unloaded meanwhile
+    bool loading;
+    // the revision of the chunk on disk, ~0 if it was never saved
+    u32 savedRevision;
+    // counts the times the pool took the chunk back, a reader that sees it change under an epoch guard
+    // held a chunk that was reclaimed too early
+    std::atomic<u32> releases;
+
+    WorldChunkT(ivec3 coords) : coords(coords), chunk(), needsRemeshing(false), mesh(), neighbours(), gridIndex(0), idleRevision(0), idleSince(0), compacted(false), stage(STAGE_EMPTY), missingNeighbours(0), cost(0), requestedAt(0), level(LEVEL_RENDER), loading(false), savedRevision(~0u), releases(0) {}
+    // the terrain is there and no generation thread or read writes the chunk anymore, the main thread can read it
+    inline bool ready() const { return stage >= STAGE_TERRAIN && !loading; }
+    // frees the chunk contents but keeps the GL objects of the mesh
+    void reset() {
+        chunk.fill(0);
+        chunk.lightlevels.fill(0);
+        entities.clear();
+        needsRemeshing = false;
+        mesh.vertices.clear();
+        mesh.indices.clear();
+        mesh.indicesCount = 0;
+        for(u32 dir=0; dir<DIRECTION_COUNT; dir++)
+            neighbours[dir] = nullptr;
+        idleSince = 0;
+        compacted = false;
+        stage = STAGE_EMPTY;
+        missingNeighbours = 0;
+        level = LEVEL_RENDER;
+        loading = false;
+        savedRevision = ~0u;
+    }
+};
+typedef WorldChunkT<CHUNK_SIZE> WorldChunk;
+
+// Slab allocator for world chunks
+// released chunks stay constructed with their GL buffers and are handed out before new slots
+struct ChunkPool {
+    struct Stats {
+        u32 slabs = 0;
+        u32 capacity = 0;
+        u32 used = 0;
+        u32 free = 0;
+        u64 reservedBytes = 0;
+        u64 acquired = 0;
+        // acquisitions that reused a released chunk
+        u64 recycled = 0;
+    };
+    struct Slab {
+        u8* memory;
+        u64 size;
+        bool mapped;
+    };
+    static constexpr u64 SLOT_SIZE = (sizeof(WorldChunk) + 63) & ~63ull;
+
+    u32 slabChunks;
+    // backs the slabs with 2MB pages when the system allows it
+    bool hugePages;
+    vector<Slab> slabs;
+    vector<WorldChunk*> freeChunks;
+    // first slot of the last slab that was never constructed
+    u32 nextSlot;
+    Stats stats;
+
+    ChunkPool(u32 slabChunks = 256, bool hugePages = false);
+    WorldChunk* acquire(ivec3 coords);
+    void release(WorldChunk* wc);
+    void destroy();
+private:
+    void addSlab();
+};
+
+// Epoch based reclamation for objects that other threads read without locks
+// readers hold a Guard while they use the pointers they found, the owner unlinks an object
+// and retires it, it is freed in collect once every reader that could have seen it left
+struct Epochs {
+    // readers inside a guard at the same time, more wait for a free slot
+    static constexpr u32 MAX_READERS = 64;
+    struct alignas(64) Reader {
+        // the epoch the reader entered in, 0 while the slot is free
+        std::atomic<u64> epoch { 0 };
+    };
+    struct Guard {
+        Epochs& epochs;
+        u32 slot;
+        Guard(Epochs& epochs);
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+    struct Retired {
+        u64 epoch;
+        std::function<void()> free;
+    };
+    std::atomic<u64> global { 1 };
+    Reader readers[MAX_READERS];
+    // owner only, in epoch order
+    vector<Retired> retired;
+    u64 freed = 0;
+
+    // call after the object can no longer be reached
+    void retire(std::function<void()> free);
+    // frees what no reader can see anymore, returns the number freed
+    u32 collect();
+    // frees everything, waiting for the readers to leave
+    void drain();
+};
+
+// Chunks by coordinates for threads other than the one that loads and unloads them
+// an open addressing table with linear probing, removed chunks leave a tombstone until the table is rebuilt
+// only the owning thread inserts and removes, lookups take no lock
+// the tables and the removed chunks are reclaimed through the epochs
+struct ChunkDirectory {
+    struct Table {
+        u32 mask;
+        std::atomic<WorldChunk*>* slots;
+    };
+    std::atomic<Table*> table;
+    Epochs epochs;
+    u32 count = 0;
+    u32 tombstones = 0;
+
+    ChunkDirectory(u32 capacity = 1024);
+    ~ChunkDirectory();
+    ChunkDirectory(const ChunkDirectory&) = delete;
+    ChunkDirectory& operator=(const ChunkDirectory&) = delete;
+    // any thread, the chunk stays valid while the guard lives
+    WorldChunk* find(const Epochs::Guard& guard, ivec3 coords) const;
+    void insert(WorldChunk* wc);
+    void remove(WorldChunk* wc);
+private:
+    static inline u32 hashOf(ivec3 coords) {
+        u32 h = (u32)coords.x*0x8da6b343u ^ (u32)coords.y*0xd8163841u ^ (u32)coords.z*0xcb1ab31fu;
+        return h ^ (h >> 15);
+    }
+    static inline WorldChunk* tombstone() { return reinterpret_cast<WorldChunk*>(alignof(WorldChunk)); }
+    void rebuild(u32 capacity);
+};
 
-    WorldChunk(ivec3 coords) : coords(coords), chunk(), needsRemeshing(false), mesh() {}
+// Toroidal grid of chunks around a center chunk
+// chunks inside the window are found by wrapping their coordinates,
+// the ones outside it fall back to a hash map until the window moves over them
+struct ChunkGrid {
+    // sizes of the window, powers of 2
+    ivec3 dims;
+    ivec3 center;
+    vector<WorldChunk*> cells;
+    std::unordered_map<ivec3, WorldChunk*> far;
+    // every chunk in the grid, for iteration
+    vector<WorldChunk*> loaded;
+    // the same chunks for the other threads
+    ChunkDirectory directory;
+
+    ChunkGrid(ivec3 dims = {32, 16, 32});
+
+    inline bool inWindow(ivec3 coords) const {
+        ivec3 d = coords - center + dims/2;
+        return (u32)d.x < (u32)dims.x && (u32)d.y < (u32)dims.y && (u32)d.z < (u32)dims.z;
+    }
+    inline u32 cellOf(ivec3 coords) const {
+        return (coords.x & (dims.x-1)) + ((coords.z & (dims.z-1)) + (coords.y & (dims.y-1))*dims.z)*dims.x;
+    }
+    inline WorldChunk* get(ivec3 coords) const {
+        if(inWindow(coords))
+            return cells[cellOf(coords)];
+        if(far.empty())
+            return nullptr;
+        auto it = far.find(coords);
+        return it == far.end() ? nullptr : it->second;
+    }
+    inline bool has(ivec3 coords) const { return get(coords) != nullptr; }
+    inline u32 size() const { return loaded.size(); }
+    inline vector<WorldChunk*>::const_iterator begin() const { return loaded.begin(); }
+    inline vector<WorldChunk*>::const_iterator end() const { return loaded.end(); }
+
+    void insert(WorldChunk* wc);
+    // returns the removed chunk, it is not freed
+    WorldChunk* remove(ivec3 coords);
+    // gives a removed chunk back to the pool once no other thread can be reading it
+    void release(WorldChunk* wc, ChunkPool& pool);
+    // releases the chunks no reader can see anymore
+    inline u32 collect() { return directory.epochs.collect(); }
+    // moves the window, chunks change between the cells and the far map
+    void recenter(ivec3 newCenter);
+};
+
+// Reads and writes blocks in world block coordinates
+// the chunk of the last access is kept, so accesses inside the same chunk skip the grid
+// and moving into a bordering chunk follows the neighbour links
+// unloaded chunks read as air and ignore writes, so do the chunks that are not ready as a generation thread may be writing them
+// writes keep the top solid blocks of the cached columns up to date when it has the cache
+struct BlockAccessor {
+    static constexpr i32 S = Chunk::CHUNKSIZE;
+    const ChunkGrid* grid;
+    ColumnCache* columns;
+    WorldChunk* wc;
+    ivec3 chunkCoords;
+    // position of the cursor
+    ivec3 pos;
+
+    BlockAccessor(const ChunkGrid& grid, ivec3 pos = {0, 0, 0}, ColumnCache* columns = nullptr) : grid(&grid), columns(columns), wc(nullptr), chunkCoords(pos >> (i32)Chunk::SIZE_LOG2), pos(pos) {
+        wc = grid.get(chunkCoords);
+        if(wc && !wc->ready())
+            wc = nullptr;
+    }
+
+    // the chunk containing the block, nullptr if it isn't loaded or not ready
+    inline WorldChunk* chunkOf(ivec3 blockPos) {
+        ivec3 c = blockPos >> (i32)Chunk::SIZE_LOG2;
+        if(c != chunkCoords)
+            moveTo(c);
+        return wc;
+    }
+    inline Chunk::blockID get(ivec3 blockPos) {
+        WorldChunk* c = chunkOf(blockPos);
+        return c ? c->chunk.getBlock(Chunk::indexOf(blockPos & (S-1))) : 0;
+    }
+    bool set(ivec3 blockPos, Chunk::blockID block);
+
+    // cursor
+    inline void seek(ivec3 blockPos) { pos = blockPos; chunkOf(pos); }
+    inline void move(Direction dir) { pos += directionVector[dir]; chunkOf(pos); }
+    inline Chunk::blockID get() { return get(pos); }
+    inline bool set(Chunk::blockID block) { return set(pos, block); }
+
+    // the box between the corners (inclusive) is stored with x changing fastest, then z, then y
+    inline static u32 regionVolume(ivec3 from, ivec3 to) { ivec3 d = to - from + 1; return d.x*d.y*d.z; }
+    void readRegion(ivec3 from, ivec3 to, Chunk::blockID* out);
+    void writeRegion(ivec3 from, ivec3 to, const Chunk::blockID* in);
+    void fillRegion(ivec3 from, ivec3 to, Chunk::blockID block);
+    // highest non air block at or below fromY in the loaded chunks
+    // the top of the first chunk below that is unloaded or not ready when there is none
+    i32 highestSolid(i32 x, i32 z, i32 fromY);
+private:
+    // after the blocks between fromY and toY of the block columns in the box changed
+    void updateColumns(ivec3 from, ivec3 to);
+    void moveTo(ivec3 newChunk);
+    // flags the chunk and the neighbours sharing a face with the changed box for remeshing
+    static void markChanged(WorldChunk* c, ivec3 lo, ivec3 hi);
+};
+
+// Packs the block and light data of idle chunks, a few chunks every update
+// a chunk is idle when it is farther than activeRadius from the center
+// or it wasn't changed or read for idleTime seconds
+struct ChunkCompactor {
+    struct Stats {
+        u32 chunks = 0;
+        u32 packedChunks = 0;
+        // block and light data, as stored and as it would be with every chunk unpacked
+        u64 storedBytes = 0;
+        u64 unpackedBytes = 0;
+    };
+    f32 idleTime = 10.0f;
+    i32 activeRadius = 2;
+    u32 chunksPerUpdate = 32;
+    // where the next update continues in ChunkGrid::loaded
+    u32 cursor = 0;
+
+    // only looks at the chunks no job can write to, so it never races with the generation
+    void update(const ChunkGrid& chunks, ivec3 center, f32 time);
+    // reads every chunk, call it while nothing is generating
+    Stats stats(const ChunkGrid& chunks) const;
+};
+
+
+struct World;
+
+// Where the player wants chunks first, updated from the player every update
+// the cost of a chunk is its distance to where the player will be in lookahead seconds,
+// lowered for the chunks in front of the camera, all in chunks
+struct ChunkFocus {
+    vec3 position = {};
+    vec3 predicted = {};
+    vec3 view = { 1, 0, 0 };
+    f32 lookahead = 1.5f;
+    // from 0 where the view doesn't matter, to 1 where the chunks in front cost nothing
+    f32 viewWeight = 0.5f;
+
+    void update(vec3 pos, vec3 vel, vec3 lookingAt);
+    inline f32 cost(ivec3 coords) const {
+        vec3 center = vec3(coords) + 0.5f;
+        vec3 dir = center - position;
+        f32 length = glm::length(dir);
+        f32 facing = length > 0.0f ? glm::dot(dir, view)/length : 1.0f;
+        return glm::length(center - predicted) * (1.0f - viewWeight*facing);
+    }
+};
+
+// Takes the chunks from empty to uploaded one stage at a time
+// the terrain is made on the generation threads, the other stages run in update within the budget
+// a chunk only moves on when its loaded neighbours reached the stage it depends on:
+// lighting needs the features of all 26 neighbours and meshing needs the 6 face neighbours lit
+struct ChunkPipeline {
+    struct Metrics {
+        // chunks waiting for a generation thread
+        u32 queued = 0;
+        // chunks that reached the target stage and the seconds it took since they were added
+        u64 visible = 0;
+        f64 totalTimeToVisible = 0;
+        f64 maxTimeToVisible = 0;
+        // moving average that follows the last chunks
+        f64 recentTimeToVisible = 0;
+    };
+    // chunks moved to each stage per update, 0 for no limit
+    u32 budget[STAGE_COUNT] = { 0, 0, 16, 16, 4, 4 };
+    // feature blocks for chunks whose terrain isn't there yet
+    std::unordered_map<ivec3, vector<FeatureWrite>> pendingWrites;
+    // chunks on the generation threads
+    u32 generating = 0;
+    // chunks being read from the storage, the ones that were never saved are generated after
+    u32 loading = 0;
+    u32 stageCounts[STAGE_COUNT] = {};
+    // chunks stop at this stage, meshing and uploading need a GL context
+    ChunkStage target = STAGE_UPLOADED;
+    // makes the GL objects of a mesh, set by the game, the chunks stop at STAGE_MESHED without it
+    void (*upload)(VoxelMesh& mesh) = nullptr;
+    // main thread time spent in every stage, the terrain is timed by the GenerationPool
+    f64 stageSeconds[STAGE_COUNT] = {};
+    Metrics metrics;
+
+    // the chunk must already be in the grid, it is read from the storage when the world has one
+    void add(World& world, WorldChunk* wc);
+    // call before taking a chunk out of the grid, it must not be generating
+    void remove(WorldChunk* wc);
+    // stops the generation of a chunk that no worker took yet, it can be removed then
+    bool cancel(World& world, WorldChunk* wc);
+    // false while some chunk is still below the target stage
+    bool update(World& world, bool unlimited = false);
+private:
+    // chunks whose read finished, no bytes when they were never saved
+    vector<pair<WorldChunk*, vector<u8>>> loaded;
+    // saved chunks in a mapped region file, decoded from the mapping in the next update
+    vector<WorldChunk*> mapped;
+    AsyncIO::Task load(World& world, WorldChunk* wc);
+    // false if the bytes are not a valid chunk, it is generated then
+    bool finishLoad(World& world, WorldChunk* wc, const u8* data, u64 size);
+    void applyPendingWrites(World& world, WorldChunk* wc);
+    bool neighboursReached(const World& world, const WorldChunk* wc, ChunkStage stage, bool diagonals) const;
+    void placeFeatures(World& world, WorldChunk* wc);
+    void seedSunlight(World& world, WorldChunk* wc);
+    // seeds the lit chunks again at or below the highest row written in each chunk column
+    void relightColumns(World& world, const std::unordered_map<ivec2, i32>& writtenRows);
+    void mesh(World& world, WorldChunk* wc);
+};
+
+// Keeps the chunk columns within radius of a column loaded at least at a level
+struct ChunkTicket {
+    ivec2 column;
+    i32 radius;
+    LoadLevel level;
 };
 
+// The tickets of a world, issued by the player, the spawn or anything else that needs chunks
+// the level of a column is the strongest level of the tickets that reach it
+struct ChunkTickets {
+    std::unordered_map<u32, ChunkTicket> tickets;
+    u32 nextID = 1;
 
+    // the id moves and removes the ticket
+    u32 add(const ChunkTicket& ticket);
+    // nullptr if it was removed
+    ChunkTicket* get(u32 id);
+    void remove(u32 id);
+    LoadLevel levelOf(ivec2 column) const;
+    // whether a ticket reaches the column with its radius grown by margin
+    bool keeps(ivec2 column, i32 margin) const;
+};
+
+// Loads the chunk columns the tickets reach and unloads the ones they let go of
+// a column is unloaded once no ticket reaches it even with unloadRadius - loadRadius
+// more columns, the gap keeps the chunks on the border from being loaded and unloaded over and over
+// the player holds three tickets that follow the center chunk: entity ticking near it,
+// render within loadRadius and render around the predicted position, as far as the gap allows
+// the missing columns that are cheapest for the ChunkFocus load first
+// the entities of unloaded chunks wait in parked until their chunk is generated again
+struct ChunkStreamer {
+    struct Stats {
+        u64 loaded = 0;
+        u64 unloaded = 0;
+        // unloaded chunks given back to the pool
+        u64 reclaimed = 0;
+        u32 parkedEntities = 0;
+        // loaded chunks at every level in the last update
+        u32 levels[LEVEL_COUNT] = {};
+    };
+    // radii of the tickets of the player, in chunk columns
+    i32 simulationRadius = 2;
+    i32 loadRadius = std::max(2, 160/(i32)Chunk::CHUNKSIZE);
+    i32 unloadRadius = std::max(2, 160/(i32)Chunk::CHUNKSIZE) + 2;
+    // chunks created and destroyed per update
+    u32 loadsPerUpdate = 16;
+    u32 unloadsPerUpdate = 16;
+    std::unordered_map<ivec3, vector<Entity*>> parked;
+    Stats stats;
+
+    // unlimited ignores the caps, for filling the load radius at once
+    void update(World& world, bool unlimited = false);
+private:
+    u32 viewTicket = 0;
+    u32 simulationTicket = 0;
+    u32 prefetchTicket = 0;
+    // column the saved chunks were last prefetched around
+    ivec2 prefetched;
+    void followCenter(World& world);
+    // false when the chunk has to stay for now
+    bool unload(World& world, WorldChunk* wc);
+};
+
+// What the player asks for in an update, the game fills it from the input before World::update
+struct PlayerControls {
+    // x to the right, y up and z forward, each in [-1, 1]
+    vec3 movement = {};
+    // change of the view angles in radians
+    vec2 turn = {};
+    // switches between walking and flying through the blocks
+    bool toggleInspect = false;
+};
+
+// draw and uploadMesh are in worldgl.cpp, the tools link the world without GL
 struct World {
-    std::unordered_map<ivec3, WorldChunk*> chunks;
-    Entity* player;
+    ChunkPool pool;
+    ChunkGrid chunks;
+    ChunkCompactor compactor;
+    u64 seed = 1;
+    WorldGenerator generator;
+    GenerationPool generation;
+    ChunkPipeline pipeline;
+    ChunkTickets tickets;
+    ChunkStreamer streamer;
+    ChunkFocus focus;
+    Entity* player = nullptr;
+    PlayerControls controls;
     ivec3 centerChunk;
+    // chunks are only kept in memory while it is not open
+    WorldStorage storage;
+    // saved state id to registry state id and back, empty while the registry matches the saved names
+    vector<u16> loadStates;
+    vector<u16> saveStates;
+    // chunk y coordinates generated in every column, the same 32 blocks of height for every chunk size
+    static inline ivec2 verticalChunks() { return { 0, std::max(1, 32/(i32)Chunk::CHUNKSIZE) }; }
+    // loads and unloads chunks around centerChunk
     void updateRenderChunks();
+    // writes the chunk if it changed since it was loaded or saved or its last save failed, lit chunks only
+    void saveChunk(WorldChunk* wc);
+    // maps the block state names saved with the world to the registry, the states missing from it are added to states
+    // and the saved states missing from the registry load as air, true if states changed
+    bool mapStates(vector<string>& states);
     void init();
+    // moves the player by the controls and the entities of the entity ticking chunks
     void update(f32 time, f32 dt);
     void draw(f32 time) const;
+    // for ChunkPipeline::upload, needs the GL context
+    static void uploadMesh(VoxelMesh& mesh);
     void destroy();
 
     static ivec3 floor(vec3 coords);
     static ivec3 chunkCoords(vec3 coords);
     static vec3 inChunkCoordsF(vec3 coords);
     static ivec3 inChunkCoordsI(vec3 coords);
-    // returns the new collided positon and the normal
+    // air when the chunk isn't loaded or ready, use a BlockAccessor for many nearby blocks
+    inline Chunk::blockID getBlock(ivec3 pos) const {
+        WorldChunk* wc = chunks.get(pos >> (i32)Chunk::SIZE_LOG2);
+        return wc && wc->ready() ? wc->chunk.getBlock(Chunk::indexOf(pos & (i32)(Chunk::CHUNKSIZE-1))) : 0;
+    }
+    // false when the chunk isn't loaded or ready, the changed chunks are remeshed in the next update
+    inline bool setBlock(ivec3 pos, Chunk::blockID block) { return BlockAccessor(chunks, pos, &generator.columns).set(block); }
+    // returns the new collided positon and the normal, chunks without their terrain yet block the move
     pair<vec3, vec3> collide(const AABB& aabb, vec3 oldpos, vec3 newpos) const;
+    // whether any block between the two corners (inclusive) is not air, chunks that are not ready read as air
+    bool regionOccupied(ivec3 from, ivec3 to) const;
+    // whether a chunk between the two corners (inclusive) is loaded but not ready
+    bool regionPending(ivec3 from, ivec3 to) const;
+
+    struct RayHit {
+        bool hit;
+        ivec3 block;
+        // face of the block that was hit
+        ivec3 normal;
+        f32 distance;
+    };
+    // steps over empty chunks and bricks instead of single voxels
+    RayHit raycast(vec3 origin, vec3 direction, f32 maxDistance) const;
 };
\ No newline at end of file
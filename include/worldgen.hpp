@@ -0,0 +1,232 @@
+#pragma once
+#include "base.hpp"
+#include "blocks.hpp"
+#include "noise.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#define GLM_ENABLE_EXPERIMENTAL
+#include "glm/gtx/hash.hpp"
+
+template<u32 SIZE> struct WorldChunkT;
+typedef WorldChunkT<CHUNK_SIZE> WorldChunk;
+
+// Counter based random numbers, a value only depends on the key and the counter
+// so chunks come out the same in any order and on any thread
+namespace Random {
+    // splitmix64 finalizer
+    inline u64 mix(u64 x) {
+        x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ull;
+        x ^= x >> 27; x *= 0x94D049BB133111EBull;
+        x ^= x >> 31;
+        return x;
+    }
+    inline u64 chunkKey(u64 seed, ivec3 coords) {
+        return mix(seed ^ mix((u64)(u32)coords.x | ((u64)(u32)coords.z << 32)) ^ mix((u64)(u32)coords.y + 0x9E3779B97F4A7C15ull));
+    }
+    inline u64 at(u64 key, u64 counter) { return mix(key + counter*0x9E3779B97F4A7C15ull); }
+    // uniform in [0, 1)
+    inline f32 unit(u64 r) { return (r >> 40) * (1.0f/16777216.0f); }
+};
+
+// Values shared by the generation threads, keyed by 2D coordinates
+// T needs an ivec2 coords member
+template<typename T>
+struct SharedCache {
+    std::mutex mutex;
+    std::unordered_map<ivec2, T*> items;
+
+    // nullptr if it isn't cached
+    T* find(ivec2 coords) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = items.find(coords);
+        return it == items.end() ? nullptr : it->second;
+    }
+    // keeps the one that got in first when two threads make the same item
+    T* insert(T* item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto inserted = items.insert({ item->coords, item });
+        if(!inserted.second)
+            delete item;
+        return inserted.first->second;
+    }
+    void evict(ivec2 coords) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = items.find(coords);
+        if(it == items.end())
+            return;
+        delete it->second;
+        items.erase(it);
+    }
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(auto& p : items)
+            delete p.second;
+        items.clear();
+    }
+};
+
+// Climate fields, each roughly in [-1, 1]
+struct Climate {
+    f32 temperature;
+    f32 humidity;
+    // flat terrain where it is high
+    f32 erosion;
+};
+
+// The climate of a square of blocks sampled every STEP blocks
+// the samples on the far edges repeat the first ones of the next region
+struct ClimateRegion {
+    static constexpr i32 STEP = 8;
+    static constexpr i32 CELLS = CHUNK_SIZE/STEP > 16 ? CHUNK_SIZE/STEP : 16;
+    static constexpr i32 BLOCKS = CELLS*STEP;
+    // chunk columns along each side, a column never straddles two regions
+    static constexpr i32 COLUMNS = BLOCKS/CHUNK_SIZE;
+    ivec2 coords;
+    Climate samples[(CELLS+1)*(CELLS+1)];
+
+    // the region of a chunk column
+    static inline ivec2 regionOf(ivec2 column) {
+        return { (column.x >= 0 ? column.x : column.x - COLUMNS+1) / COLUMNS, (column.y >= 0 ? column.y : column.y - COLUMNS+1) / COLUMNS };
+    }
+
+    // bilinear between the 4 samples around the block column, in world block coordinates
+    Climate at(i32 x, i32 z) const;
+};
+
+enum BiomeID: u8 {
+    BIOME_PLAINS,
+    BIOME_FOREST,
+    BIOME_DESERT,
+    BIOME_BADLANDS,
+    BIOME_ROCKY,
+    BIOME_COUNT
+};
+
+struct Biome {
+    const char* name;
+    u16 surface;
+    // the few blocks under the surface
+    u16 subsurface;
+    // trees tried in every chunk column
+    u32 trees;
+};
+
+// Data of a column of chunks, shared by all the chunks stacked in it
+// indexed by the block column, x changing fastest
+struct ChunkColumn {
+    static constexpr i32 S = CHUNK_SIZE;
+    ivec2 coords;
+    // generated surface height
+    i32 heights[S*S];
+    // block placed at the surface height
+    u16 surface[S*S];
+    BiomeID biomes[S*S];
+    // highest non air block, kept up to date by the edits made through a BlockAccessor
+    i32 topSolid[S*S];
+
+    static inline u32 indexOf(ivec3 blockPos) { return (blockPos.x & (S-1)) + (blockPos.z & (S-1))*S; }
+    // whether nothing above the block can block the sky
+    inline bool skyExposed(ivec3 blockPos) const { return blockPos.y > topSolid[indexOf(blockPos)]; }
+};
+typedef SharedCache<ChunkColumn> ColumnCache;
+
+// a block placed by a feature, it only replaces air
+struct FeatureWrite {
+    ivec3 pos;
+    u16 block;
+};
+
+struct WorldGenerator {
+    // blocks used by the generator, resolved once so that generation does no name lookups
+    struct Palette {
+        u16 stone, cobblestone, dirt, sand, redSand, grass;
+        // the axis property of the log picks the orientation
+        u16 logX, logY, logZ;
+    };
+    u64 seed;
+    u32 noiseSeed;
+    Palette palette;
+    Biome biomes[BIOME_COUNT];
+    // the surface height is baseHeight + heightScale * warped fbm of the column
+    // the erosion of the climate flattens it down to flatScale of the height scale
+    Noise::Fractal heightNoise = { 5, 1.0f/128.0f, 2.0f, 0.5f };
+    Noise::Fractal warpNoise = { 2, 1.0f/256.0f, 2.0f, 0.5f };
+    Noise::Fractal climateNoise = { 3, 1.0f/512.0f, 2.0f, 0.5f };
+    f32 warpAmount = 32.0f;
+    f32 baseHeight = 16.0f;
+    f32 heightScale = 12.0f;
+    f32 flatScale = 0.3f;
+    // caves are carved where the 3D density is above caveThreshold, it is evaluated on a lattice
+    // of CAVE_STEP_XZ x CAVE_STEP_Y x CAVE_STEP_XZ cells and interpolated inside them
+    static constexpr i32 CAVE_STEP_XZ = 4;
+    static constexpr i32 CAVE_STEP_Y = 8;
+    Noise::Fractal caveNoise = { 3, 1.0f/48.0f, 2.0f, 0.5f };
+    f32 caveThreshold = 0.3f;
+    // evaluates the density at every block instead, for comparing against the lattice
+    bool fullResolutionCaves = false;
+    SharedCache<ClimateRegion> climate;
+    ColumnCache columns;
+
+    // resolves the palette, the registry must be initialized
+    void init(u64 worldSeed);
+    // the cached column, made on the first call
+    ChunkColumn* column(ivec2 coords);
+    // the cached region, made on the first call
+    ClimateRegion* climateRegion(ivec2 coords);
+    BiomeID biomeOf(const Climate& climate) const;
+    // the terrain, safe to call from several threads at once
+    void generate(Chunk& chunk, ivec3 coords);
+    // removes the blocks under the surface where the density makes caves
+    void carveCaves(Chunk& chunk, ivec3 coords);
+    // blocks of the features rooted in the chunk, they can reach into the neighbouring chunks
+    void features(ivec3 coords, vector<FeatureWrite>& out);
+    void destroy();
+};
+
+// Generates chunks on the job system
+// the main thread submits chunks and collects them once they are done
+// every submitted chunk schedules a job that takes the queued chunk with the lowest cost, equal costs in submission order
+struct GenerationPool {
+    struct Job {
+        f32 cost;
+        u64 order;
+        WorldChunk* wc;
+        // for the heap, the top is the cheapest
+        inline bool operator<(const Job& other) const { return cost != other.cost ? cost > other.cost : order > other.order; }
+    };
+    WorldGenerator* generator = nullptr;
+    std::mutex mutex;
+    // a heap of the chunks no job took yet
+    vector<Job> queued;
+    u64 submitted = 0;
+    vector<WorldChunk*> finished;
+    u32 running = 0;
+    // jobs scheduled that did not start yet, they can outnumber the queued chunks after a cancel
+    u32 scheduled = 0;
+    // time spent generating summed over the jobs
+    f64 busySeconds = 0;
+
+    void start(WorldGenerator& gen);
+    void submit(WorldChunk* wc, f32 cost = 0);
+    // takes the chunk out of the queue, false if a job already has it
+    bool cancel(WorldChunk* wc);
+    // gives every queued chunk a new cost, returns the number of queued chunks
+    template<typename F> u32 rescore(F cost) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(Job& job : queued)
+            job.cost = cost(job.wc);
+        std::make_heap(queued.begin(), queued.end());
+        return queued.size();
+    }
+    // moves the generated chunks to out without waiting
+    void collect(vector<WorldChunk*>& out);
+    // runs jobs until every submitted chunk is generated
+    void wait();
+    // drops the queued chunks and waits for the scheduled jobs
+    void stop();
+private:
+    void work();
+};
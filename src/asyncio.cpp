@@ -0,0 +1,387 @@
+#include "asyncio.hpp"
+#include "engine.hpp"
+#include "jobs.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#ifdef __linux__
+    #include <linux/io_uring.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+
+namespace AsyncIO {
+
+Stats stats;
+// made during the frame, sent in the next update
+static vector<Request*> queued;
+// finished on the jobs, resumed in the next update
+static std::mutex doneMutex;
+static vector<Request*> done;
+
+#ifdef __linux__
+// the rings shared with the kernel, the head and tail indices are read and written with atomics
+struct Ring {
+    i32 fd = -1;
+    u32 entries;
+    u32* sqHead;
+    u32* sqTail;
+    u32* sqMask;
+    u32* sqArray;
+    io_uring_sqe* sqes;
+    u32* cqHead;
+    u32* cqTail;
+    u32* cqMask;
+    io_uring_cqe* cqes;
+    void* sqMemory;
+    u64 sqSize;
+    void* cqMemory;
+    u64 cqSize;
+    u64 sqesSize;
+    // requests given to the kernel that did not complete yet
+    u32 inFlight = 0;
+    // requests in the submission ring that the kernel did not take yet
+    u32 unsubmitted = 0;
+};
+static Ring ring;
+
+static bool setupRing(u32 depth) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    i32 fd = syscall(__NR_io_uring_setup, depth, &params);
+    if(fd < 0)
+        return false;
+    ring.fd = fd;
+    ring.entries = params.sq_entries;
+    ring.sqSize = params.sq_off.array + params.sq_entries*sizeof(u32);
+    ring.cqSize = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single)
+        ring.sqSize = ring.cqSize = std::max(ring.sqSize, ring.cqSize);
+    ring.sqMemory = mmap(nullptr, ring.sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring.cqMemory = single ? ring.sqMemory : mmap(nullptr, ring.cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring.sqesSize = params.sq_entries*sizeof(io_uring_sqe);
+    ring.sqes = (io_uring_sqe*)mmap(nullptr, ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(ring.sqMemory == MAP_FAILED || ring.cqMemory == MAP_FAILED || ring.sqes == MAP_FAILED) {
+        close(fd);
+        ring.fd = -1;
+        return false;
+    }
+    u8* sq = (u8*)ring.sqMemory;
+    ring.sqHead = (u32*)(sq + params.sq_off.head);
+    ring.sqTail = (u32*)(sq + params.sq_off.tail);
+    ring.sqMask = (u32*)(sq + params.sq_off.ring_mask);
+    ring.sqArray = (u32*)(sq + params.sq_off.array);
+    u8* cq = (u8*)ring.cqMemory;
+    ring.cqHead = (u32*)(cq + params.cq_off.head);
+    ring.cqTail = (u32*)(cq + params.cq_off.tail);
+    ring.cqMask = (u32*)(cq + params.cq_off.ring_mask);
+    ring.cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// reads and writes at an offset came with Linux 5.6, older rings fail every one of them
+static bool supportsReadWrite() {
+    u64 size = sizeof(io_uring_probe) + 256*sizeof(io_uring_probe_op);
+    vector<u8> memory(size, 0);
+    io_uring_probe* probe = (io_uring_probe*)memory.data();
+    if(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+        return false;
+    for(u8 op : { (u8)IORING_OP_READ, (u8)IORING_OP_WRITE })
+        if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            return false;
+    return true;
+}
+
+static void destroyRing() {
+    munmap(ring.sqes, ring.sqesSize);
+    if(ring.cqMemory != ring.sqMemory)
+        munmap(ring.cqMemory, ring.cqSize);
+    munmap(ring.sqMemory, ring.sqSize);
+    close(ring.fd);
+    ring.fd = -1;
+}
+
+// false when the submission ring is full
+static bool pushRing(Request* r) {
+    if(ring.inFlight == ring.entries)
+        return false;
+    u32 tail = *ring.sqTail;
+    u32 index = tail & *ring.sqMask;
+    io_uring_sqe& sqe = ring.sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = r->op == Request::READ ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe.fd = r->fd;
+    sqe.off = r->offset + r->transferred;
+    sqe.addr = (u64)(r->bytes.data() + r->transferred);
+    sqe.len = r->bytes.size() - r->transferred;
+    sqe.user_data = (u64)r;
+    ring.sqArray[index] = index;
+    __atomic_store_n(ring.sqTail, tail+1, __ATOMIC_RELEASE);
+    ring.inFlight++;
+    ring.unsubmitted++;
+    return true;
+}
+
+// hands the requests in the submission ring to the kernel, what it does not take now goes in a later call
+static bool submitRing() {
+    bool sent = false;
+    while(ring.unsubmitted > 0) {
+        i32 n = syscall(__NR_io_uring_enter, ring.fd, ring.unsubmitted, 0, 0, nullptr, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0) {
+            // out of memory for requests or too many completions waiting, they go out in the next update
+            if(errno != EAGAIN && errno != EBUSY)
+                Log::error("Cannot submit file requests to io_uring: ", strerror(errno));
+            break;
+        }
+        if(n == 0)
+            break;
+        ring.unsubmitted -= n;
+        sent = true;
+    }
+    return sent;
+}
+
+// the short reads and writes are sent again for the rest into retry
+static void reapRing(vector<Request*>& out, vector<Request*>& retry) {
+    u32 head = *ring.cqHead;
+    u32 tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++) {
+        io_uring_cqe& cqe = ring.cqes[head & *ring.cqMask];
+        Request* r = (Request*)cqe.user_data;
+        ring.inFlight--;
+        if(cqe.res == -EINTR || cqe.res == -EAGAIN) {
+            retry.push_back(r);
+            continue;
+        }
+        if(cqe.res > 0 && r->transferred + cqe.res < r->bytes.size()) {
+            r->transferred += cqe.res;
+            retry.push_back(r);
+            continue;
+        }
+        // 0 is the end of the file for a read
+        r->result = cqe.res < 0 ? cqe.res : (i64)(r->transferred + cqe.res);
+        out.push_back(r);
+    }
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+}
+#endif
+
+// pread or pwrite until everything is moved, the bytes moved or a negative errno
+static i64 transfer(bool writing, i32 fd, u8* data, u64 size, u64 offset) {
+    u64 moved = 0;
+    while(moved < size) {
+        i64 n = writing ? pwrite(fd, data + moved, size - moved, offset + moved) : pread(fd, data + moved, size - moved, offset + moved);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return -errno;
+        if(n == 0)
+            break;
+        moved += n;
+    }
+    return moved;
+}
+
+// the blocking version of a request, on the jobs
+static void perform(Request* r) {
+    switch(r->op) {
+    case Request::READ:
+    case Request::WRITE:
+        r->result = transfer(r->op == Request::WRITE, r->fd, r->bytes.data(), r->bytes.size(), r->offset);
+        break;
+    case Request::READ_FILE: {
+        i32 fd = open(r->path.c_str(), O_RDONLY);
+        struct stat st;
+        if(fd < 0 || fstat(fd, &st) != 0) {
+            r->result = -errno;
+            if(fd >= 0) close(fd);
+            break;
+        }
+        r->bytes.resize(st.st_size);
+        r->result = transfer(false, fd, r->bytes.data(), r->bytes.size(), 0);
+        close(fd);
+        break;
+    }
+    case Request::WRITE_FILE: {
+        i32 fd = open(r->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            r->result = -errno;
+            break;
+        }
+        r->result = transfer(true, fd, r->bytes.data(), r->bytes.size(), 0);
+        close(fd);
+        break;
+    }
+    }
+}
+
+void init(bool useUring, u32 depth) {
+    #ifdef __linux__
+        stats.uring = useUring && setupRing(depth);
+        if(stats.uring && !supportsReadWrite()) {
+            Log::warning("io_uring cannot read and write files on this kernel");
+            destroyRing();
+            stats.uring = false;
+        }
+    #else
+        (void)useUring;
+        (void)depth;
+    #endif
+    Log::info("Async file requests on ", stats.uring ? "io_uring" : "the jobs");
+}
+
+void destroy() {
+    drain();
+    #ifdef __linux__
+        if(stats.uring)
+            destroyRing();
+    #endif
+    stats.uring = false;
+}
+
+void Awaitable::await_suspend(std::coroutine_handle<> handle) {
+    request.waiter = handle;
+    queued.push_back(&request);
+    stats.requests++;
+    stats.inFlight++;
+}
+
+void update() {
+    vector<Request*> batch;
+    batch.swap(queued);
+    vector<Request*> finished;
+    bool sent = false;
+    #ifdef __linux__
+        if(stats.uring) {
+            for(u32 i=0; i<batch.size(); i++) {
+                Request* r = batch[i];
+                if(r->op != Request::READ && r->op != Request::WRITE)
+                    continue;
+                // what does not fit waits for the next update
+                if(!pushRing(r))
+                    queued.push_back(r);
+                batch[i] = nullptr;
+            }
+            // one system call for the whole frame
+            sent = submitRing();
+            reapRing(finished, queued);
+        }
+    #endif
+    for(Request* r : batch) {
+        if(!r)
+            continue;
+        Jobs::run("file request", [r]() {
+            perform(r);
+            std::lock_guard<std::mutex> lock(doneMutex);
+            done.push_back(r);
+        });
+        sent = true;
+    }
+    if(sent)
+        stats.batches++;
+    {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        finished.insert(finished.end(), done.begin(), done.end());
+        done.clear();
+    }
+    for(Request* r : finished) {
+        r->finished = true;
+        if(r->result < 0) {
+            // a missing file is how a chunk that was never saved looks
+            if(r->result != -ENOENT)
+                stats.errors++;
+            if(r->op == Request::READ || r->op == Request::READ_FILE)
+                r->bytes.clear();
+        }
+        else if(r->op == Request::READ || r->op == Request::READ_FILE) {
+            r->bytes.resize(r->result);
+            stats.bytesRead += r->result;
+        }
+        else
+            stats.bytesWritten += r->result;
+        stats.inFlight--;
+        // the request lives in the coroutine frame, it is gone once the coroutine goes on
+        r->waiter.resume();
+    }
+}
+
+bool idle() {
+    return stats.inFlight == 0;
+}
+
+void drain() {
+    while(!idle()) {
+        u32 before = stats.inFlight;
+        update();
+        if(stats.inFlight < before || Jobs::help())
+            continue;
+        #ifdef __linux__
+            // only the requests the kernel took can complete
+            if(stats.uring && ring.inFlight > ring.unsubmitted) {
+                syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                continue;
+            }
+        #endif
+        std::this_thread::yield();
+    }
+}
+
+i32 openFile(const string& path, bool write) {
+    return write ? open(path.c_str(), O_RDWR | O_CREAT, 0644) : open(path.c_str(), O_RDONLY);
+}
+
+void closeFile(i32 fd) {
+    if(fd >= 0)
+        close(fd);
+}
+
+Awaitable read(i32 fd, u64 offset, u32 size) {
+    Awaitable a;
+    a.request.op = Request::READ;
+    a.request.fd = fd;
+    a.request.offset = offset;
+    a.request.bytes.resize(size);
+    return a;
+}
+
+Awaitable write(i32 fd, u64 offset, vector<u8> bytes) {
+    Awaitable a;
+    a.request.op = Request::WRITE;
+    a.request.fd = fd;
+    a.request.offset = offset;
+    a.request.bytes = std::move(bytes);
+    return a;
+}
+
+Awaitable readFile(const string& path) {
+    Awaitable a;
+    a.request.op = Request::READ_FILE;
+    a.request.path = path;
+    return a;
+}
+
+Awaitable writeFile(const string& path, vector<u8> bytes) {
+    Awaitable a;
+    a.request.op = Request::WRITE_FILE;
+    a.request.path = path;
+    a.request.bytes = std::move(bytes);
+    return a;
+}
+
+Awaitable completed(vector<u8> bytes) {
+    Awaitable a;
+    a.request.op = Request::READ;
+    a.request.result = bytes.size();
+    a.request.bytes = std::move(bytes);
+    a.request.finished = true;
+    return a;
+}
+
+};
@@ -43,6 +43,35 @@ bool fileExists(const char* filename) {
     return access(filename, F_OK) == 0;
 }
 
+bool writeFileBytes(const char* filename, const u8* bytes, u64 size) {
+    FILE* f = fopen(filename, "wb");
+    if(!f) return false;
+    bool written = fwrite(bytes, 1, size, f) == size;
+    return fclose(f) == 0 && written;
+}
+
+#include <cerrno>
+#include <sys/stat.h>
+#ifdef WIN32
+    #include <direct.h>
+#endif
+
+bool makeFolder(const char* name) {
+    string path = name;
+    for(u64 i=1; i<=path.size(); i++) {
+        if(i < path.size() && path[i] != '/')
+            continue;
+        string part = path.substr(0, i);
+        #ifdef WIN32
+            if(_mkdir(part.c_str()) != 0 && errno != EEXIST)
+        #else
+            if(mkdir(part.c_str(), 0755) != 0 && errno != EEXIST)
+        #endif
+            return false;
+    }
+    return true;
+}
+
 bool FileEntry::hasExtension(const string& ext) const {
     if(name.size() < ext.size()+1)
         return false;
@@ -54,8 +83,13 @@ void FileEntry::removeExtension(u32 extsize) {
     name.resize(name.size()-extsize-1);
 }
 
+#include <algorithm>
 #include <dirent.h>
 
+static void sortByName(vector<FileEntry>& entries) {
+    std::sort(entries.begin(), entries.end(), [](const FileEntry& a, const FileEntry& b) { return a.name < b.name; });
+}
+
 vector<FileEntry> readFolder(const char* name) {
     DIR* dir;
     struct dirent* entry;
@@ -73,6 +107,7 @@ vector<FileEntry> readFolder(const char* name) {
         entry = readdir(dir);
     }
     closedir(dir);
+    sortByName(result);
     return result;
 }
 
@@ -109,6 +144,7 @@ vector<FileEntry> readFolderRecursively(const char* name) {
     string foldername = name;
     string basename = "";
     readFolderR(foldername, basename, result);
+    sortByName(result);
     return result;
 }
 
@@ -43,6 +43,21 @@ Block::Block(string blockName, DataEntry* de) : name(blockName) {
     // TODO: add error message to block creation
 }
 
+i32 BlockType::propertyIndex(const string& propName) const {
+    for(u32 i=0; i<properties.size(); i++)
+        if(properties[i].name == propName)
+            return i;
+    return -1;
+}
+
+i32 BlockType::valueIndex(u32 property, const string& value) const {
+    const vector<string>& values = properties[property].values;
+    for(u32 i=0; i<values.size(); i++)
+        if(values[i] == value)
+            return i;
+    return -1;
+}
+
 BlockModel* NoModel::constructor(DataEntry* de) {
     (void) de;
     return new NoModel();
@@ -205,9 +220,9 @@ void CubeModel::addToMesh(BlockModel::DrawInfo drawinfo) {
         ivec3 dv = directionVector[dir];
         Chunk::blockID bid = 0;
         if(drawinfo.chunk.inBounds(drawinfo.blockPos + dv))
-            bid = drawinfo.chunk.blocks[Chunk::indexOf(drawinfo.blockPos + dv)];
+            bid = drawinfo.chunk.getBlock(Chunk::indexOf(drawinfo.blockPos + dv));
         else if(drawinfo.neighbours[dir] != nullptr)
-            bid = drawinfo.neighbours[dir]->blocks[Chunk::indexOf(drawinfo.blockPos + dv - dv*(i32)Chunk::CHUNKSIZE)];
+            bid = drawinfo.neighbours[dir]->getBlock(Chunk::indexOf(drawinfo.blockPos + dv - dv*(i32)Chunk::CHUNKSIZE));
         else goto draw;
         if((Registry::blocks.items[bid]->solidity & (1<<dir)) == 0)
             goto draw;
@@ -232,7 +247,7 @@ void CubeModel::addToMesh(BlockModel::DrawInfo drawinfo) {
             vvi[fv].uv.y += Registry::ATLASDIM-1 - textureID/Registry::ATLASDIM;
             vvi[fv].xyz += drawinfo.blockPos;
             VoxelVertex vv;
-            vv.pos_ao    = (vvi[fv].xyz.x) | (vvi[fv].xyz.y << 6) | (vvi[fv].xyz.z << 12);
+            vv.pos_ao    = (vvi[fv].xyz.x) | (vvi[fv].xyz.y << Chunk::POS_BITS) | (vvi[fv].xyz.z << 2*Chunk::POS_BITS);
             vv.texCoords = (vvi[fv].uv.x) | (vvi[fv].uv.y << 8);
             drawinfo.mesh.vertices.push_back(vv);
         }
@@ -242,7 +257,7 @@ void CubeModel::addToMesh(BlockModel::DrawInfo drawinfo) {
         // for each vertex we check the block on the sides on color it less the more neighbours it has
         for(u32 faceVertex=0; faceVertex<4; faceVertex++) {
             VoxelVertex& vertex = drawinfo.mesh.vertices[drawinfo.mesh.vertices.size()-4+faceVertex];
-            ivec3 p = { (vertex.pos_ao&0x3F), (vertex.pos_ao&0xFC0)>>6,(vertex.pos_ao&0x3F000)>>12 };
+            ivec3 p = { vertex.pos_ao & Chunk::POS_MASK, (vertex.pos_ao >> Chunk::POS_BITS) & Chunk::POS_MASK, (vertex.pos_ao >> 2*Chunk::POS_BITS) & Chunk::POS_MASK };
             vec3 g = vec3(p) - vec3(drawinfo.blockPos);
             //cout << g.x << " " << g.y << " " << g.z << "\n";
             g = vec3(-1, -1, -1) + 2.0f*g;
@@ -254,11 +269,11 @@ void CubeModel::addToMesh(BlockModel::DrawInfo drawinfo) {
                 //cout << "{" << nsint.x << " " << nsint.y << " " << nsint.z << "} ";
                 nsint += drawinfo.blockPos;
                 if(drawinfo.chunk.inBounds(nsint)) {
-                    if(drawinfo.chunk.blocks[drawinfo.chunk.indexOf(nsint)] != 0)
+                    if(drawinfo.chunk.getBlock(drawinfo.chunk.indexOf(nsint)) != 0)
                         neighbours++;
                 }
             }
-            vertex.pos_ao |= (neighbours << 18);
+            vertex.pos_ao |= (neighbours << 3*Chunk::POS_BITS);
             //cout << vertex.x << " " << vertex.y << " " << vertex.z << " -> ";
             //vertex.pos_ao = neighbours*64*64*64 + vertex.pos_ao;
             //cout << (vertex.pos_ao % 64) << " " <<
@@ -62,8 +62,10 @@ DataEntry::DataEntry(Type t) {
 
 DataEntry::~DataEntry() {
     switch(type) {
-        case UNKOWN:
         case ERROR:
+            error.message.~string();
+            break;
+        case UNKOWN:
         case LEAF:
         case TYPE_COUNT:
         case INT8:
@@ -111,6 +113,18 @@ DataEntry::~DataEntry() {
         }
 }
 
+void DataEntry::deleteTree(DataEntry* de) {
+    if(de == nullptr)
+        return;
+    if(de->type == LIST || de->type == VECTOR)
+        for(DataEntry* child : de->list)
+            deleteTree(child);
+    else if(de->type == MAP)
+        for(const std::pair<const string, DataEntry*>& p : de->dict)
+            deleteTree(p.second);
+    delete de;
+}
+
 DataEntry* DataEntry::copy() const {
     DataEntry* result = new DataEntry(type);
     switch (type) {
@@ -485,7 +499,7 @@ DataEntry* DataEntry::readFromText(const string &text, u32& index) {
         while(true) {
             ignoreWS(text, index);
             if(index == text.size())
-                ERR("Dictionary not closed", delete dict);
+                ERR("Dictionary not closed", deleteTree(dict));
             if(text[index] == '}') {
                 index++;
                 return dict;
@@ -496,23 +510,23 @@ DataEntry* DataEntry::readFromText(const string &text, u32& index) {
             else if(isValidDictEntry(text[index]))
                 key = getAtom(text, index);
             else
-                ERR("Unexpected character in dictionary", delete dict);
+                ERR("Unexpected character in dictionary", deleteTree(dict));
             if(index == text.size()) 
-                ERR("Unexpected end of input in dictionary", delete dict);
+                ERR("Unexpected end of input in dictionary", deleteTree(dict));
             ignoreWS(text, index);
             if(index == text.size() || text[index] != ':') 
-                ERR("Key must be followed by colon", delete dict);
+                ERR("Key must be followed by colon", deleteTree(dict));
             index++;
             DataEntry* value = readFromText(text, index);
             if(value->type == ERROR) {
-                delete dict;
+                deleteTree(dict);
                 return value;
             }
             else
                 dict->dict[key] = value;
             ignoreWS(text, index);      
             if(index == text.size() || (text[index] != ',' && text[index] != '}')) 
-                ERR("Key value pairs must be separated by commas", delete dict);
+                ERR("Key value pairs must be separated by commas", deleteTree(dict));
             if(text[index] == ',')
                 index++;
         }
@@ -523,21 +537,21 @@ DataEntry* DataEntry::readFromText(const string &text, u32& index) {
         while(true) {
             ignoreWS(text, index);
             if(index == text.size())
-                ERR("List not closed", delete list);
+                ERR("List not closed", deleteTree(list));
             if(text[index] == ']') {
                 index++;
                 return list;
             }
             DataEntry* element = readFromText(text, index);
             if(element->type == ERROR) {
-                delete list;
+                deleteTree(list);
                 return element;
             }
             else
                 list->list.push_back(element);
             ignoreWS(text, index);      
             if(index == text.size() || (text[index] != ',' && text[index] != ']')) 
-                ERR("List elements must be sepparated by commas", delete list);
+                ERR("List elements must be sepparated by commas", deleteTree(list));
             if(text[index] == ',')
                 index++;
         }
@@ -3,73 +3,6 @@
 #include "resources.hpp"
 
 
-std::ofstream Log::logfile;
-const Log::logger Log::fatal = logger {
-    .color = 1,
-    .prefix = "FATAL",
-    .shouldExit = true
-};
-const Log::logger Log::error = logger {
-    .color = 1,
-    .prefix = "ERROR",
-    .shouldExit = false
-};
-const Log::logger Log::warning = logger {
-    .color = 1,
-    .prefix = "WARN",
-    .shouldExit = false
-};
-const Log::logger Log::info = logger {
-    .color = 1,
-    .prefix = "INFO",
-    .shouldExit = false
-};
-
-#ifdef WINDOWS
-
-#include <windows.h>
-
-HANDLE hConsole;
-CONSOLE_SCREEN_BUFFER_INFO consoleInfo;
-WORD saved_attributes;
-
-void initConsole() {
-    hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    GetConsoleScreenBufferInfo(hConsole, &consoleInfo);
-    saved_attributes = consoleInfo.wAttributes;
-}
-
-void Log::changeColor(u8 color) {
-    SetConsoleTextAttribute(hConsole, FOREGROUND_BLUE);
-}
-
-void Log::resetColor() {
-    SetConsoleTextAttribute(hConsole, saved_attributes);
-}
-
-#else
-
-void initConsole() {}
-
-void Log::changeColor(u8 color) {
-    (void) color;
-    // TODO: implement colors in logging
-    cerr << "\x1b[0;30m";
-}
-
-void Log::resetColor() {
-    cerr << "\x1b[0m";
-}
-
-#endif
-
-void Log::init() {
-    initConsole();
-    logfile.open("output/log.txt");
-    if(!logfile.is_open()) ERR_EXIT("Cound not open log file");
-}
-
-
 bool Input::disabledCursor = false;
 vec2 Input::mousePos = { 0, 0 };
 vec2 Input::mouseDiff = { 0, 0 }; 
@@ -215,7 +215,7 @@ void CuboidsEntityModel::makeMesh(Entity* entity) {
                 mesh.indices.push_back(mesh.vertices.size()-4 + 2);
             }
         }
-        mesh.makeObjects();
+        // the GL objects are made when the entity is first drawn
         entity->meshes.push_back(mesh);
     }
     
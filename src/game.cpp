@@ -3,6 +3,8 @@
 #include "renderer.hpp"
 #include "resources.hpp"
 #include "engine.hpp"
+#include "asyncio.hpp"
+#include "jobs.hpp"
 #include <GLFW/glfw3.h>
 #include <cstring>
 #include <glm/ext/matrix_clip_space.hpp>
@@ -79,11 +81,41 @@ void Game::processInput(f32 dt) {
     lastMousePos = Input::mousePos;
 }
 
+// the keys and the mouse of this frame as the controls of the player
+static void readControls(World& world) {
+    static constexpr float cameraAngleSpeed = 2.0f;
+    PlayerControls& controls = world.controls;
+    controls.movement = {0, 0, 0};
+    if(Input::isPressed(GLFW_KEY_W))
+        controls.movement += vec3(0, 0, 1);
+    if(Input::isPressed(GLFW_KEY_A))
+        controls.movement += vec3(-1, 0, 0);
+    if(Input::isPressed(GLFW_KEY_S))
+        controls.movement += vec3(0, 0, -1);
+    if(Input::isPressed(GLFW_KEY_D))
+        controls.movement += vec3(1, 0, 0);
+    if(Input::isPressed(GLFW_KEY_UP))
+        controls.movement += vec3(0, 1, 0);
+    if(Input::isPressed(GLFW_KEY_DOWN))
+        controls.movement += vec3(0, -1, 0);
+    if(Input::events["escape"].happened())
+        Input::toggleCursor();
+    controls.toggleInspect = Input::events["spectator_toggle"].happened();
+    controls.turn = {0, 0};
+    if(Input::disabledCursor)
+        controls.turn = vec2(Input::mouseDiff.x/window::width, Input::mouseDiff.y/window::height) * cameraAngleSpeed;
+}
+
 void Game::init() {
     Log::init();
+    Jobs::init();
+    AsyncIO::init();
     window::init(1200, 900, "Hello warld");
     Input::init();
     Registry::init();
+    if(!testWorld.storage.open("saves/world", World::verticalChunks()))
+        Log::warning("Cannot open the save folder, the world stays in memory");
+    testWorld.pipeline.upload = World::uploadMesh;
     testWorld.init();
     window::beginDrawing();
     window::endDrawing();
@@ -104,8 +136,11 @@ void Game::run() {
         fpst += dt;
         fpsc++;
         if(fpst > 1.0f) {
-            if(printFPS)
-                cout << fpsc/fpst << " FPS\n";
+            if(printFPS) {
+                const ChunkPipeline& pipeline = testWorld.pipeline;
+                cout << fpsc/fpst << " FPS, chunks: " << pipeline.metrics.queued << " queued, " << testWorld.chunks.size() - pipeline.stageCounts[STAGE_UPLOADED] << " not visible, "
+                     << pipeline.metrics.recentTimeToVisible*1000 << " ms to visible (max " << pipeline.metrics.maxTimeToVisible*1000 << " ms)\n";
+            }
             fpsc = 0;
             fpst = 0.0f;
         }
@@ -113,6 +148,9 @@ void Game::run() {
         glfwPollEvents();
         //processInput(dt);
         Input::processInput();
+        Jobs::runMainQueue();
+        AsyncIO::update();
+        readControls(testWorld);
         testWorld.update(time, dt);
 
         window::beginDrawing();
@@ -139,5 +177,9 @@ void Game::run() {
 }
 
 void Game::destory() {
+    testWorld.destroy();
+    AsyncIO::destroy();
+    Jobs::logStats();
+    Jobs::destroy();
     window::destroy();
 }
\ No newline at end of file
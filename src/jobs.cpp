@@ -0,0 +1,284 @@
+#include "jobs.hpp"
+#include "engine.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+namespace Jobs {
+
+struct JobData {
+    const char* name;
+    std::function<void()> f;
+    // unfinished dependencies, plus one until it is submitted
+    std::atomic<i32> waiting { 1 };
+    std::atomic<bool> done { false };
+    std::mutex mutex;
+    vector<Job> continuations;
+};
+
+struct Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+};
+
+static vector<std::thread> threads;
+static vector<Queue*> queues;
+// jobs submitted from threads that are not workers
+static Queue shared;
+static thread_local i32 workerIndex = -1;
+static std::atomic<i32> pending { 0 };
+static std::atomic<bool> stopping { false };
+static std::mutex sleepMutex;
+static std::condition_variable sleeping;
+static std::mutex doneMutex;
+static std::condition_variable doneSignal;
+static std::mutex statsMutex;
+static map<string, TaskStats> taskStats;
+static std::mutex mainMutex;
+static vector<pair<const char*, std::function<void()>>> mainQueue;
+
+static void record(const char* name, f64 seconds) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    TaskStats& s = taskStats[name];
+    s.count++;
+    s.totalSeconds += seconds;
+    s.maxSeconds = std::max(s.maxSeconds, seconds);
+}
+
+static void schedule(const Job& job) {
+    // counted before it is visible so a thief can never take it first
+    pending++;
+    Queue& queue = workerIndex >= 0 ? *queues[workerIndex] : shared;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(job);
+    }
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    sleeping.notify_one();
+}
+
+static Job take() {
+    Job job;
+    if(workerIndex >= 0) {
+        Queue& own = *queues[workerIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+        }
+    }
+    if(!job) {
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        if(!shared.jobs.empty()) {
+            job = std::move(shared.jobs.front());
+            shared.jobs.pop_front();
+        }
+    }
+    for(u32 i=1; !job && i<=queues.size(); i++) {
+        Queue& other = *queues[(workerIndex + (i32) i) % (i32) queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if(!other.jobs.empty()) {
+            job = std::move(other.jobs.front());
+            other.jobs.pop_front();
+        }
+    }
+    if(job)
+        pending--;
+    return job;
+}
+
+static void execute(const Job& job) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    job->f();
+    record(job->name, std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count());
+    job->f = nullptr;
+    vector<Job> continuations;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->done = true;
+        continuations.swap(job->continuations);
+    }
+    for(const Job& next : continuations)
+        if(--next->waiting == 0)
+            schedule(next);
+    { std::lock_guard<std::mutex> lock(doneMutex); }
+    doneSignal.notify_all();
+}
+
+static void work(i32 index) {
+    workerIndex = index;
+    while(!stopping) {
+        Job job = take();
+        if(job) {
+            execute(job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleeping.wait(lock, []() { return stopping || pending > 0; });
+    }
+}
+
+void init(u32 count) {
+    if(count == 0)
+        count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    count = std::max(1u, count);
+    stopping = false;
+    for(u32 i=0; i<count; i++)
+        queues.push_back(new Queue());
+    for(u32 i=0; i<count; i++)
+        threads.emplace_back(work, (i32) i);
+    Log::info("Job system running on ", count, " worker threads");
+}
+
+void destroy() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    sleeping.notify_all();
+    for(std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+    for(Queue* queue : queues)
+        delete queue;
+    queues.clear();
+    shared.jobs.clear();
+    pending = 0;
+}
+
+u32 threadCount() {
+    return threads.size();
+}
+
+Job create(const char* name, std::function<void()> f) {
+    Job job = std::make_shared<JobData>();
+    job->name = name;
+    job->f = std::move(f);
+    return job;
+}
+
+void dependsOn(const Job& job, const Job& dependency) {
+    std::lock_guard<std::mutex> lock(dependency->mutex);
+    if(dependency->done)
+        return;
+    job->waiting++;
+    dependency->continuations.push_back(job);
+}
+
+void submit(const Job& job) {
+    if(--job->waiting == 0)
+        schedule(job);
+}
+
+Job run(const char* name, std::function<void()> f) {
+    Job job = create(name, std::move(f));
+    submit(job);
+    return job;
+}
+
+bool finished(const Job& job) {
+    return job->done;
+}
+
+bool help() {
+    Job job = take();
+    if(!job)
+        return false;
+    execute(job);
+    return true;
+}
+
+// helps until done returns true, sleeps a little when there is nothing to run
+template<typename F> static void helpUntil(F done) {
+    while(!done()) {
+        if(help())
+            continue;
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneSignal.wait_for(lock, std::chrono::milliseconds(1), [&]() { return done() || pending > 0; });
+    }
+}
+
+void wait(const Job& job) {
+    helpUntil([&]() { return finished(job); });
+}
+
+// the batches of a parallelFor, taken in order by the caller and its jobs
+struct Batches {
+    const std::function<void(u32)>* f;
+    u32 count, grain, total;
+    std::atomic<u32> next { 0 };
+    std::atomic<u32> finished { 0 };
+
+    // runs batches until none are left, returns how many it ran
+    u32 runAll() {
+        u32 ran = 0;
+        for(u32 b = next++; b < total; b = next++) {
+            u32 end = std::min(count, (b+1)*grain);
+            for(u32 i=b*grain; i<end; i++)
+                (*f)(i);
+            ran++;
+            finished++;
+        }
+        return ran;
+    }
+};
+
+void parallelFor(const char* name, u32 count, u32 grain, const std::function<void(u32)>& f) {
+    grain = std::max(1u, grain);
+    u32 total = (count + grain - 1) / grain;
+    if(total <= 1 || threads.empty()) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for(u32 i=0; i<count; i++)
+            f(i);
+        if(count > 0)
+            record(name, std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count());
+        return;
+    }
+    // the jobs can start after every batch is taken, they only touch f while they hold a batch
+    std::shared_ptr<Batches> batches = std::make_shared<Batches>();
+    batches->f = &f;
+    batches->count = count;
+    batches->grain = grain;
+    batches->total = total;
+    u32 jobs = std::min<u32>(total-1, threads.size());
+    for(u32 j=0; j<jobs; j++)
+        run(name, [batches]() { batches->runAll(); });
+    // the caller only runs batches of its own, an unrelated job could keep it away for much longer
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(batches->runAll() > 0)
+        record(name, std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count());
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneSignal.wait(lock, [&]() { return batches->finished == total; });
+}
+
+void runOnMain(const char* name, std::function<void()> f) {
+    std::lock_guard<std::mutex> lock(mainMutex);
+    mainQueue.push_back({ name, std::move(f) });
+}
+
+u32 runMainQueue() {
+    vector<pair<const char*, std::function<void()>>> jobs;
+    {
+        std::lock_guard<std::mutex> lock(mainMutex);
+        jobs.swap(mainQueue);
+    }
+    for(auto& [name, f] : jobs) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        f();
+        record(name, std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count());
+    }
+    return jobs.size();
+}
+
+map<string, TaskStats> stats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return taskStats;
+}
+
+void logStats() {
+    for(const auto& [name, s] : stats())
+        Log::info("Task ", name, ": ", s.count, " runs, ", s.totalSeconds*1000, " ms total, ", s.totalSeconds*1000/s.count, " ms average, ", s.maxSeconds*1000, " ms max");
+}
+
+};
@@ -0,0 +1,311 @@
+#include "noise.hpp"
+#include <cmath>
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+// The kernels are written once against these lane types
+// F holds floats, I holds 32 bit integers that wrap on overflow
+
+struct ScalarLanes {
+    static constexpr u32 N = 1;
+    struct F { f32 v; };
+    struct I { u32 v; };
+    friend inline F operator+(F a, F b) { return { a.v + b.v }; }
+    friend inline F operator-(F a, F b) { return { a.v - b.v }; }
+    friend inline F operator*(F a, F b) { return { a.v * b.v }; }
+    friend inline F operator-(F a) { return { -a.v }; }
+    friend inline I operator+(I a, I b) { return { a.v + b.v }; }
+    friend inline I operator*(I a, I b) { return { a.v * b.v }; }
+    friend inline I operator^(I a, I b) { return { a.v ^ b.v }; }
+    friend inline I operator&(I a, I b) { return { a.v & b.v }; }
+    friend inline I operator>>(I a, i32 s) { return { a.v >> s }; }
+    static inline F load(const f32* p) { return { *p }; }
+    static inline void store(f32* p, F a) { *p = a.v; }
+    static inline F set(f32 a) { return { a }; }
+    static inline I seti(u32 a) { return { a }; }
+    static inline F floor(F a) { return { std::floor(a.v) }; }
+    // for floats holding integers
+    static inline I toInt(F a) { return { (u32)(i32)a.v }; }
+    static inline F max(F a, F b) { return { a.v > b.v ? a.v : b.v }; }
+    static inline F selectGreater(F a, F b, F t, F f) { return a.v > b.v ? t : f; }
+    // t where the bit of h is set
+    static inline F selectBit(I h, u32 bit, F t, F f) { return (h.v & bit) ? t : f; }
+    static inline F selectEqual(I a, u32 c, F t, F f) { return a.v == c ? t : f; }
+};
+
+#if defined(__AVX2__)
+struct SimdLanes {
+    static constexpr u32 N = 8;
+    static constexpr const char* name = "AVX2";
+    struct F { __m256 v; };
+    struct I { __m256i v; };
+    friend inline F operator+(F a, F b) { return { _mm256_add_ps(a.v, b.v) }; }
+    friend inline F operator-(F a, F b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    friend inline F operator*(F a, F b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    friend inline F operator-(F a) { return { _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)) }; }
+    friend inline I operator+(I a, I b) { return { _mm256_add_epi32(a.v, b.v) }; }
+    friend inline I operator*(I a, I b) { return { _mm256_mullo_epi32(a.v, b.v) }; }
+    friend inline I operator^(I a, I b) { return { _mm256_xor_si256(a.v, b.v) }; }
+    friend inline I operator&(I a, I b) { return { _mm256_and_si256(a.v, b.v) }; }
+    friend inline I operator>>(I a, i32 s) { return { _mm256_srli_epi32(a.v, s) }; }
+    static inline F load(const f32* p) { return { _mm256_loadu_ps(p) }; }
+    static inline void store(f32* p, F a) { _mm256_storeu_ps(p, a.v); }
+    static inline F set(f32 a) { return { _mm256_set1_ps(a) }; }
+    static inline I seti(u32 a) { return { _mm256_set1_epi32(a) }; }
+    static inline F floor(F a) { return { _mm256_floor_ps(a.v) }; }
+    static inline I toInt(F a) { return { _mm256_cvttps_epi32(a.v) }; }
+    static inline F max(F a, F b) { return { _mm256_max_ps(a.v, b.v) }; }
+    static inline F selectGreater(F a, F b, F t, F f) { return { _mm256_blendv_ps(f.v, t.v, _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)) }; }
+    static inline F selectBit(I h, u32 bit, F t, F f) {
+        __m256i unset = _mm256_cmpeq_epi32(_mm256_and_si256(h.v, _mm256_set1_epi32(bit)), _mm256_setzero_si256());
+        return { _mm256_blendv_ps(t.v, f.v, _mm256_castsi256_ps(unset)) };
+    }
+    static inline F selectEqual(I a, u32 c, F t, F f) {
+        return { _mm256_blendv_ps(f.v, t.v, _mm256_castsi256_ps(_mm256_cmpeq_epi32(a.v, _mm256_set1_epi32(c)))) };
+    }
+};
+#elif defined(__SSE2__)
+struct SimdLanes {
+    static constexpr u32 N = 4;
+    static constexpr const char* name = "SSE2";
+    struct F { __m128 v; };
+    struct I { __m128i v; };
+    static inline __m128 blend(__m128 f, __m128 t, __m128 mask) { return _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, f)); }
+    friend inline F operator+(F a, F b) { return { _mm_add_ps(a.v, b.v) }; }
+    friend inline F operator-(F a, F b) { return { _mm_sub_ps(a.v, b.v) }; }
+    friend inline F operator*(F a, F b) { return { _mm_mul_ps(a.v, b.v) }; }
+    friend inline F operator-(F a) { return { _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)) }; }
+    friend inline I operator+(I a, I b) { return { _mm_add_epi32(a.v, b.v) }; }
+    // SSE2 only multiplies the even lanes
+    friend inline I operator*(I a, I b) {
+        __m128i even = _mm_mul_epu32(a.v, b.v);
+        __m128i odd = _mm_mul_epu32(_mm_srli_si128(a.v, 4), _mm_srli_si128(b.v, 4));
+        return { _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0))) };
+    }
+    friend inline I operator^(I a, I b) { return { _mm_xor_si128(a.v, b.v) }; }
+    friend inline I operator&(I a, I b) { return { _mm_and_si128(a.v, b.v) }; }
+    friend inline I operator>>(I a, i32 s) { return { _mm_srli_epi32(a.v, s) }; }
+    static inline F load(const f32* p) { return { _mm_loadu_ps(p) }; }
+    static inline void store(f32* p, F a) { _mm_storeu_ps(p, a.v); }
+    static inline F set(f32 a) { return { _mm_set1_ps(a) }; }
+    static inline I seti(u32 a) { return { _mm_set1_epi32(a) }; }
+    // no round instruction before SSE4.1, truncate and step down the negative ones
+    static inline F floor(F a) {
+        __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+        return { _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f))) };
+    }
+    static inline I toInt(F a) { return { _mm_cvttps_epi32(a.v) }; }
+    static inline F max(F a, F b) { return { _mm_max_ps(a.v, b.v) }; }
+    static inline F selectGreater(F a, F b, F t, F f) { return { blend(f.v, t.v, _mm_cmpgt_ps(a.v, b.v)) }; }
+    static inline F selectBit(I h, u32 bit, F t, F f) {
+        __m128i unset = _mm_cmpeq_epi32(_mm_and_si128(h.v, _mm_set1_epi32(bit)), _mm_setzero_si128());
+        return { blend(t.v, f.v, _mm_castsi128_ps(unset)) };
+    }
+    static inline F selectEqual(I a, u32 c, F t, F f) {
+        return { blend(f.v, t.v, _mm_castsi128_ps(_mm_cmpeq_epi32(a.v, _mm_set1_epi32(c)))) };
+    }
+};
+#else
+struct SimdLanes : ScalarLanes {
+    static constexpr const char* name = "scalar";
+};
+#endif
+
+const u32 Noise::LANES = SimdLanes::N;
+const char* const Noise::INSTRUCTION_SET = SimdLanes::name;
+
+template<typename L>
+static inline typename L::I hash(typename L::I i, typename L::I j, typename L::I k, typename L::I seed) {
+    typename L::I h = seed ^ (i * L::seti(0x1DE4E5D1)) ^ (j * L::seti(0x43C3A8CD)) ^ (k * L::seti(0x6689D36F));
+    h = h * L::seti(0x27D4EB2D);
+    return h ^ (h >> 15);
+}
+
+// one of 8 directions
+template<typename L>
+static inline typename L::F grad2(typename L::I h, typename L::F x, typename L::F y) {
+    typename L::F u = L::selectBit(h, 4, y, x);
+    typename L::F v = L::selectBit(h, 4, x, y);
+    return L::selectBit(h, 1, -u, u) + L::selectBit(h, 2, -v, v) * L::set(2.0f);
+}
+
+// one of the 12 cube edge directions, 4 of them repeated
+template<typename L>
+static inline typename L::F grad3(typename L::I h, typename L::F x, typename L::F y, typename L::F z) {
+    typename L::F u = L::selectBit(h, 8, y, x);
+    typename L::F v = L::selectEqual(h & L::seti(12), 0, y, L::selectEqual(h & L::seti(13), 12, x, z));
+    return L::selectBit(h, 1, -u, u) + L::selectBit(h, 2, -v, v);
+}
+
+template<typename L>
+static inline typename L::F simplex2(typename L::F x, typename L::F y, typename L::I seed) {
+    typedef typename L::F F;
+    typedef typename L::I I;
+    const f32 F2 = 0.36602540378f, G2 = 0.21132486540f;
+    F zero = L::set(0.0f), one = L::set(1.0f);
+    F s = (x + y) * L::set(F2);
+    F fi = L::floor(x + s), fj = L::floor(y + s);
+    F t = (fi + fj) * L::set(G2);
+    F x0 = x - (fi - t), y0 = y - (fj - t);
+    // which triangle of the skewed square
+    F i1 = L::selectGreater(x0, y0, one, zero);
+    F j1 = one - i1;
+    F x1 = x0 - i1 + L::set(G2), y1 = y0 - j1 + L::set(G2);
+    F x2 = x0 - L::set(1.0f - 2.0f*G2), y2 = y0 - L::set(1.0f - 2.0f*G2);
+    I i = L::toInt(fi), j = L::toInt(fj), k = L::seti(0);
+    I h0 = hash<L>(i, j, k, seed);
+    I h1 = hash<L>(i + L::toInt(i1), j + L::toInt(j1), k, seed);
+    I h2 = hash<L>(i + L::seti(1), j + L::seti(1), k, seed);
+    F t0 = L::max(L::set(0.5f) - x0*x0 - y0*y0, zero);
+    F t1 = L::max(L::set(0.5f) - x1*x1 - y1*y1, zero);
+    F t2 = L::max(L::set(0.5f) - x2*x2 - y2*y2, zero);
+    t0 = t0*t0; t1 = t1*t1; t2 = t2*t2;
+    F n = t0*t0*grad2<L>(h0, x0, y0) + t1*t1*grad2<L>(h1, x1, y1) + t2*t2*grad2<L>(h2, x2, y2);
+    return n * L::set(45.23f);
+}
+
+template<typename L>
+static inline typename L::F simplex3(typename L::F x, typename L::F y, typename L::F z, typename L::I seed) {
+    typedef typename L::F F;
+    typedef typename L::I I;
+    const f32 F3 = 1.0f/3.0f, G3 = 1.0f/6.0f;
+    F zero = L::set(0.0f), one = L::set(1.0f);
+    F s = (x + y + z) * L::set(F3);
+    F fi = L::floor(x + s), fj = L::floor(y + s), fk = L::floor(z + s);
+    F t = (fi + fj + fk) * L::set(G3);
+    F x0 = x - (fi - t), y0 = y - (fj - t), z0 = z - (fk - t);
+    // which of the 6 tetrahedra, from the order of the coordinates
+    F xy = L::selectGreater(x0, y0, one, zero);
+    F xz = L::selectGreater(x0, z0, one, zero);
+    F yz = L::selectGreater(y0, z0, one, zero);
+    F i1 = xy*xz, j1 = (one - xy)*yz, k1 = (one - xz)*(one - yz);
+    F i2 = L::max(xy, xz), j2 = L::max(one - xy, yz), k2 = L::max(one - xz, one - yz);
+    F x1 = x0 - i1 + L::set(G3), y1 = y0 - j1 + L::set(G3), z1 = z0 - k1 + L::set(G3);
+    F x2 = x0 - i2 + L::set(2.0f*G3), y2 = y0 - j2 + L::set(2.0f*G3), z2 = z0 - k2 + L::set(2.0f*G3);
+    F x3 = x0 - L::set(1.0f - 3.0f*G3), y3 = y0 - L::set(1.0f - 3.0f*G3), z3 = z0 - L::set(1.0f - 3.0f*G3);
+    I i = L::toInt(fi), j = L::toInt(fj), k = L::toInt(fk);
+    I h0 = hash<L>(i, j, k, seed);
+    I h1 = hash<L>(i + L::toInt(i1), j + L::toInt(j1), k + L::toInt(k1), seed);
+    I h2 = hash<L>(i + L::toInt(i2), j + L::toInt(j2), k + L::toInt(k2), seed);
+    I h3 = hash<L>(i + L::seti(1), j + L::seti(1), k + L::seti(1), seed);
+    F t0 = L::max(L::set(0.6f) - x0*x0 - y0*y0 - z0*z0, zero);
+    F t1 = L::max(L::set(0.6f) - x1*x1 - y1*y1 - z1*z1, zero);
+    F t2 = L::max(L::set(0.6f) - x2*x2 - y2*y2 - z2*z2, zero);
+    F t3 = L::max(L::set(0.6f) - x3*x3 - y3*y3 - z3*z3, zero);
+    t0 = t0*t0; t1 = t1*t1; t2 = t2*t2; t3 = t3*t3;
+    F n = t0*t0*grad3<L>(h0, x0, y0, z0) + t1*t1*grad3<L>(h1, x1, y1, z1)
+        + t2*t2*grad3<L>(h2, x2, y2, z2) + t3*t3*grad3<L>(h3, x3, y3, z3);
+    return n * L::set(32.8f);
+}
+
+static f32 fractalNorm(const Noise::Fractal& fractal) {
+    f32 amplitude = 1.0f, sum = 0.0f;
+    for(u32 o=0; o<fractal.octaves; o++) {
+        sum += amplitude;
+        amplitude *= fractal.gain;
+    }
+    return sum > 0.0f ? 1.0f/sum : 0.0f;
+}
+
+template<typename L>
+static inline typename L::F fbm2(typename L::F x, typename L::F y, u32 seed, const Noise::Fractal& fractal) {
+    typename L::F sum = L::set(0.0f);
+    f32 frequency = fractal.frequency, amplitude = 1.0f;
+    for(u32 o=0; o<fractal.octaves; o++) {
+        typename L::F f = L::set(frequency);
+        sum = sum + simplex2<L>(x*f, y*f, L::seti(seed + o)) * L::set(amplitude);
+        frequency *= fractal.lacunarity;
+        amplitude *= fractal.gain;
+    }
+    return sum * L::set(fractalNorm(fractal));
+}
+
+template<typename L>
+static inline typename L::F fbm3(typename L::F x, typename L::F y, typename L::F z, u32 seed, const Noise::Fractal& fractal) {
+    typename L::F sum = L::set(0.0f);
+    f32 frequency = fractal.frequency, amplitude = 1.0f;
+    for(u32 o=0; o<fractal.octaves; o++) {
+        typename L::F f = L::set(frequency);
+        sum = sum + simplex3<L>(x*f, y*f, z*f, L::seti(seed + o)) * L::set(amplitude);
+        frequency *= fractal.lacunarity;
+        amplitude *= fractal.gain;
+    }
+    return sum * L::set(fractalNorm(fractal));
+}
+
+// runs the kernel over full batches of lanes and the rest one point at a time
+template<typename K>
+static void evaluate2(const K& kernel, const f32* x, const f32* y, f32* out, u32 count) {
+    u32 i = 0;
+    for(; i+SimdLanes::N <= count; i+=SimdLanes::N)
+        SimdLanes::store(out+i, kernel.template eval<SimdLanes>(SimdLanes::load(x+i), SimdLanes::load(y+i)));
+    for(; i<count; i++)
+        ScalarLanes::store(out+i, kernel.template eval<ScalarLanes>(ScalarLanes::load(x+i), ScalarLanes::load(y+i)));
+}
+
+template<typename K>
+static void evaluate3(const K& kernel, const f32* x, const f32* y, const f32* z, f32* out, u32 count) {
+    u32 i = 0;
+    for(; i+SimdLanes::N <= count; i+=SimdLanes::N)
+        SimdLanes::store(out+i, kernel.template eval<SimdLanes>(SimdLanes::load(x+i), SimdLanes::load(y+i), SimdLanes::load(z+i)));
+    for(; i<count; i++)
+        ScalarLanes::store(out+i, kernel.template eval<ScalarLanes>(ScalarLanes::load(x+i), ScalarLanes::load(y+i), ScalarLanes::load(z+i)));
+}
+
+struct Simplex2Kernel {
+    u32 seed;
+    template<typename L> typename L::F eval(typename L::F x, typename L::F y) const { return simplex2<L>(x, y, L::seti(seed)); }
+};
+
+struct Simplex3Kernel {
+    u32 seed;
+    template<typename L> typename L::F eval(typename L::F x, typename L::F y, typename L::F z) const { return simplex3<L>(x, y, z, L::seti(seed)); }
+};
+
+struct Fbm2Kernel {
+    u32 seed;
+    const Noise::Fractal& fractal;
+    template<typename L> typename L::F eval(typename L::F x, typename L::F y) const { return fbm2<L>(x, y, seed, fractal); }
+};
+
+struct Fbm3Kernel {
+    u32 seed;
+    const Noise::Fractal& fractal;
+    template<typename L> typename L::F eval(typename L::F x, typename L::F y, typename L::F z) const { return fbm3<L>(x, y, z, seed, fractal); }
+};
+
+struct WarpedFbm2Kernel {
+    u32 seed;
+    const Noise::Fractal& fractal;
+    const Noise::Fractal& warp;
+    f32 warpAmount;
+    template<typename L> typename L::F eval(typename L::F x, typename L::F y) const {
+        typename L::F amount = L::set(warpAmount);
+        typename L::F wx = fbm2<L>(x, y, seed ^ 0x5BD1E995u, warp) * amount;
+        typename L::F wy = fbm2<L>(x, y, seed ^ 0x1B873593u, warp) * amount;
+        return fbm2<L>(x + wx, y + wy, seed, fractal);
+    }
+};
+
+void Noise::simplex2(const f32* x, const f32* y, f32* out, u32 count, u32 seed) {
+    evaluate2(Simplex2Kernel{ seed }, x, y, out, count);
+}
+
+void Noise::simplex3(const f32* x, const f32* y, const f32* z, f32* out, u32 count, u32 seed) {
+    evaluate3(Simplex3Kernel{ seed }, x, y, z, out, count);
+}
+
+void Noise::fbm2(const f32* x, const f32* y, f32* out, u32 count, u32 seed, const Fractal& fractal) {
+    evaluate2(Fbm2Kernel{ seed, fractal }, x, y, out, count);
+}
+
+void Noise::fbm3(const f32* x, const f32* y, const f32* z, f32* out, u32 count, u32 seed, const Fractal& fractal) {
+    evaluate3(Fbm3Kernel{ seed, fractal }, x, y, z, out, count);
+}
+
+void Noise::warpedFbm2(const f32* x, const f32* y, f32* out, u32 count, u32 seed, const Fractal& fractal, const Fractal& warp, f32 warpAmount) {
+    evaluate2(WarpedFbm2Kernel{ seed, fractal, warp, warpAmount }, x, y, out, count);
+}
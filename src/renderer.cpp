@@ -58,6 +58,10 @@ u32 gl::generateVAO() {
     return VAO;
 }
 
+void gl::bindVAO(u32 VAO) {
+    glBindVertexArray(VAO);
+}
+
 void gl::drawVAO(u32 VAO, u32 count) {
     glBindVertexArray(VAO);
     glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, nullptr);
@@ -1,14 +1,17 @@
 #include "resources.hpp"
 #include "base.hpp"
 #include "data.hpp"
+#include "jobs.hpp"
 #include "renderer.hpp"
 #include "world.hpp"
+#include <bit>
 #include <cstring>
 #include <stb_image.h>
-#include <stb_image_write.h>
 
 registry<TextureRI> Registry::textures;
 registry<Block*> Registry::blocks;
+registry<BlockType> Registry::blockTypes;
+vector<u16> Registry::blockStateTypes;
 registry<BlockModelRI> Registry::blockModels;
 registry<GLTexture> Registry::glTextures;
 registry<u32> Registry::shaders;
@@ -27,6 +30,8 @@ u32* Registry::makeAtlas() {
 }
 
 void Registry::addToAtlas(u32 *atlasData, u32 &index, const string& folder) {
+    // the tiles are given out in name order, then the images are decoded in parallel
+    vector<pair<string, u32>> tiles;
     for(auto& p : textures.names) {
         if(p.first.compare(0, folder.size(), folder) != 0)
             continue;
@@ -34,95 +39,108 @@ void Registry::addToAtlas(u32 *atlasData, u32 &index, const string& folder) {
             continue;
         if(index == ATLASTILE*ATLASTILE)
             ERR_EXIT("Atlas too small");
-        stbi_set_flip_vertically_on_load(false);
-        string filename = "assets/textures/" + p.first + ".png";
+        tiles.push_back({ p.first, index });
+        textures.items[p.second].usage = TextureRI::ATLAS;
+        textures.items[p.second].usageID = index;
+        index++;
+    }
+    // the flag is global in stb_image, so it is set once before the jobs start
+    stbi_set_flip_vertically_on_load(false);
+    Jobs::parallelFor("decode atlas texture", tiles.size(), 4, [&](u32 i) {
+        const string& name = tiles[i].first;
+        u32 tile = tiles[i].second;
+        string filename = "assets/textures/" + name + ".png";
         i32 imageWidth, imageHeight, imageChannels;
         u8* newdata = stbi_load(filename.c_str(), &imageWidth, &imageHeight, &imageChannels, 4);
-        // cout << "ATLAS " << p.first << " at " << filename << ": " << imageChannels << " " << imageWidth << " " << imageHeight << "\n";
-        if(newdata == nullptr) ERR_EXIT("Could not load image " << p.first << ", " << filename);
+        if(newdata == nullptr) ERR_EXIT("Could not load image " << name << ", " << filename);
         if(imageWidth != ATLASTILE || imageHeight != ATLASTILE)
-            ERR_EXIT("Image not in apropriate format " << p.first);
+            ERR_EXIT("Image not in apropriate format " << name);
         if(imageChannels == 3)
             imageChannels = 4;
         if(imageChannels != 4)
-            ERR_EXIT("Image not in apropriate format " << p.first);
+            ERR_EXIT("Image not in apropriate format " << name);
         for(u32 y=0; y < ATLASTILE; y++) for(u32 x=0; x < ATLASTILE; x++)
-            atlasData[((index/ATLASDIM)*ATLASTILE + y)*ATLASTILE*ATLASDIM + (index%ATLASDIM)*ATLASTILE + x] = ((u32*)newdata)[ATLASTILE*y+x];
+            atlasData[((tile/ATLASDIM)*ATLASTILE + y)*ATLASTILE*ATLASDIM + (tile%ATLASDIM)*ATLASTILE + x] = ((u32*)newdata)[ATLASTILE*y+x];
         stbi_image_free(newdata);
-        textures.items[p.second].usage = TextureRI::ATLAS;
-        textures.items[p.second].usageID = index;
-        index++;
-    }
+    });
 }
 
-GLTexture Registry::finishAtlas(u32* atlasData) {
-    #ifdef DEBUG
-        stbi_write_png("output/atlas_new.png", ATLASTILE*ATLASDIM, ATLASTILE*ATLASDIM, 4, atlasData, ATLASTILE*ATLASDIM*4);
-    #endif
-    // Finally we must flip everything in acordance to OpenGL
-    for(u32 y=0; y<ATLASTILE*ATLASDIM/2; y++) for(u32 x=0; x<ATLASTILE*ATLASDIM; x++) {
-        u32 temp = atlasData[y*ATLASTILE*ATLASDIM+x];
-        atlasData[y*ATLASTILE*ATLASDIM+x] = atlasData[(ATLASDIM*ATLASTILE-y-1)*ATLASTILE*ATLASDIM+x];
-        atlasData[(ATLASDIM*ATLASTILE-y-1)*ATLASTILE*ATLASDIM+x] = temp;
-    };
-    GLTexture tex;
-    tex.height = tex.width = ATLASTILE*ATLASDIM;
-    tex.glid = gl::textureFromMemory((u8*)atlasData, ATLASDIM*ATLASTILE, ATLASDIM*ATLASTILE, 4);
-    free(atlasData);
-    return tex;
+// whether a variant key like "axis_x" or "color_red/wood_oak" applies to the state
+static bool variantMatches(const BlockType& type, u32 offset, const string& key) {
+    size_t begin = 0;
+    while(begin <= key.size()) {
+        size_t end = key.find('/', begin);
+        if(end == string::npos) end = key.size();
+        string part = key.substr(begin, end-begin);
+        bool found = false;
+        for(u32 i=0; i<type.properties.size() && !found; i++) {
+            const BlockProperty& prop = type.properties[i];
+            if(part.size() <= prop.name.size() || part.compare(0, prop.name.size(), prop.name) != 0 || part[prop.name.size()] != '_')
+                continue;
+            i32 value = type.valueIndex(i, part.substr(prop.name.size()+1));
+            if(value < 0) continue;
+            if(type.getProperty(type.baseState + offset, i) != (u32)value) return false;
+            found = true;
+        }
+        if(!found) return false;
+        begin = end+1;
+    }
+    return true;
 }
 
 void addBlockToRegistry(DataEntry* de, const string& name) {
     if(!de || !de->isMap()) return;
-    if(!de->has("variants")) {
-        Registry::blocks.add(name, new Block(name, de));
-        return;
+    BlockType type;
+    type.name = name;
+    type.baseState = Registry::blocks.items.size();
+    u32 shift = 0;
+    DataEntry* propsDE = de->schild("properties");
+    if(propsDE && propsDE->isMap()) for(const std::pair<string, DataEntry*> p : propsDE->dict) {
+        if(!p.second->isStringable() || !Registry::enums.has(p.second->str))
+            continue; // TODO: add error message to block creation
+        BlockProperty prop;
+        prop.name = p.first;
+        prop.values = Registry::enums[p.second->str];
+        prop.bits = std::bit_width(prop.values.size() > 1 ? prop.values.size()-1 : 0);
+        prop.shift = shift;
+        shift += prop.bits;
+        type.properties.push_back(prop);
     }
-    DataEntry* variants = de->child("variants");
-    de->dict.erase(de->dict.find("variants"));
-    if(!variants->isMap()) return;
-    for(const std::pair<string, DataEntry*> p : variants->dict) {
-        string variantName = name + "/" + p.first;
-        DataEntry* variantDE = de->copy();
-        variantDE->mergeStructure(p.second);
-        Registry::blocks.add(variantName, new Block(variantName, variantDE));
-        delete variantDE;
+    if(type.baseState + (1ull << shift) > 0x10000)
+        ERR_EXIT("Too many block states when adding block " << name);
+    type.stateCount = 1u << shift;
+    u16 typeIndex = Registry::blockTypes.items.size();
+
+    DataEntry* variants = nullptr;
+    if(de->has("variants")) {
+        variants = de->child("variants");
+        de->dict.erase(de->dict.find("variants"));
     }
-    de->dict["variants"] = variants;
-}
-
-void Registry::makeGLTextures(const string &folder) {
-    for(auto& p : textures.names) {
-        if(p.first.compare(0, folder.size(), folder) != 0)
-            continue;
-        if(p.first.size() < folder.size()+2)
+    for(u32 offset=0; offset<type.stateCount; offset++) {
+        string stateName = name;
+        bool valid = true;
+        for(u32 i=0; i<type.properties.size(); i++) {
+            u32 value = type.getProperty(type.baseState + offset, i);
+            if(value >= type.properties[i].values.size()) valid = false;
+            else stateName += "/" + type.properties[i].name + "_" + type.properties[i].values[value];
+        }
+        Registry::blockStateTypes.push_back(typeIndex);
+        if(!valid) {
+            Registry::blocks.items.push_back(Registry::blocks.items[type.baseState]);
             continue;
-        stbi_set_flip_vertically_on_load(false);
-        string filename = "assets/textures/" + p.first + ".png";
-        i32 imageWidth, imageHeight, imageChannels;
-        u8* newdata = stbi_load(filename.c_str(), &imageWidth, &imageHeight, &imageChannels, 4);
-        if(newdata == nullptr) return;
-        if(imageChannels != 3 && imageChannels != 4) { 
-            ERR_EXIT("could not do file bohoho " << p.first); 
-            stbi_image_free(newdata); 
-            return; 
         }
-        u32 glid = gl::textureFromMemory(newdata, imageWidth, imageHeight, 4);
-        stbi_image_free(newdata);
-        glTextures.add(p.first, {
-            .glid = glid,
-            .width = (u32)imageWidth,
-            .height = (u32)imageHeight,
-            .name = p.first
-        });
-        textures.items[p.second].usage = TextureRI::GLTEXTURE;
-        textures.items[p.second].usageID = glTextures.items.size()-1;
+        DataEntry* stateDE = de->copy();
+        if(variants && variants->isMap()) for(const std::pair<string, DataEntry*> p : variants->dict)
+            if(variantMatches(type, offset, p.first))
+                stateDE->mergeStructure(p.second);
+        Registry::blocks.add(stateName, new Block(stateName, stateDE));
+        delete stateDE;
     }
+    if(variants) de->dict["variants"] = variants;
+    Registry::blockTypes.add(name, type);
 }
 
-void Registry::init() {
-
-    // enums 
+void Registry::registerEnums() {
     DataEntry* enumsDE = DataEntry::readText(readFileString("assets/dev/enums.td"));
     if(enumsDE->isMap()) {
         // TODO: what is this warning
@@ -138,56 +156,33 @@ void Registry::init() {
                 DataEntry::enums[item->str] = i;
                 i++;
             }
-            enums.add(p.first, vs);
+            Registry::enums.add(p.first, vs);
         }
     }
     delete enumsDE;
+}
 
-    // shaders
-    vector<FileEntry> shadersFES = readFolderRecursively("assets/shaders");
-    for(FileEntry& fe : shadersFES) {
-        if(!fe.hasExtension("glsl"))
-            continue;
-        fe.removeExtension(4);
-        if(!fe.hasExtension("vert"))
-            continue;
-        fe.removeExtension(4);
-        string vertName = "assets/shaders/" + fe.name + ".vert.glsl";
-        string fragName = "assets/shaders/" + fe.name + ".frag.glsl";
-        if(!fileExists(fragName.c_str()))
-            continue;
-        u32 shader = gl::makeProgram(
-            readFileString(vertName.c_str()), 
-            readFileString(fragName.c_str())
-        );
-        shaders.add(fe.name, shader);
-    }
-
-    // textures
+void Registry::registerTextures() {
     vector<FileEntry> textureFES = readFolderRecursively("assets/textures");
-    textures.add("missing", { 0, TextureRI::UNUSED, 0, "missing" });
+    Registry::textures.add("missing", { 0, TextureRI::UNUSED, 0, "missing" });
     for(FileEntry fe : textureFES) {
         if(!fe.hasExtension("png"))
             continue;
         fe.removeExtension(3);
-        textures.add(fe.name, { (u32)textures.items.size(), TextureRI::UNUSED, 0, fe.name });
+        Registry::textures.add(fe.name, { (u32)Registry::textures.items.size(), TextureRI::UNUSED, 0, fe.name });
     }
+}
 
-    // block models
-    blockModels.add("none", { NoModel::constructor, 0, "none"});
-    blockModels.add("cube", { CubeModel::constructor, 0b111111, "cube" });
-
-    // atlas & textures
-    u32* atlasData = makeAtlas();
-    u32 atlasIndex = 1;
-    addToAtlas(atlasData, atlasIndex, "blocks");
-    glTextures.add("atlas", finishAtlas(atlasData));
-    glTextures.items[glTextures.names["atlas"]].name = "atlas";
-    makeGLTextures("entities");
+void Registry::registerBlockModels() {
+    Registry::blockModels.add("none", { NoModel::constructor, 0, "none"});
+    Registry::blockModels.add("cube", { CubeModel::constructor, 0b111111, "cube" });
+}
 
-    // blocks
+void Registry::registerBlocks() {
     vector<FileEntry> blockFES = readFolder("assets/blocks");
-    blocks.add("air", new Block("air", nullptr));
+    Registry::blocks.add("air", new Block("air", nullptr));
+    Registry::blockTypes.add("air", { "air", 0, 1, {} });
+    Registry::blockStateTypes.push_back(0);
     for(FileEntry fe : blockFES) {
         if(!fe.hasExtension("td"))
             continue;
@@ -201,12 +196,12 @@ void Registry::init() {
         addBlockToRegistry(de, fe.name);
         delete de;
     }
+}
 
-    // enity models
+void Registry::registerEntities() {
     entityModels.add("none", { NoEntityModel::constructor, "none" });
     entityModels.add("cuboids", { CuboidsEntityModel::constructor, "cuboids" });
 
-    // entities
     vector<FileEntry> entityFES = readFolder("assets/entities");
     for(FileEntry fe : entityFES) {
         if(!fe.hasExtension("td"))
@@ -224,5 +219,18 @@ void Registry::init() {
         entities.items[entities.items.size()-1].id = entities.items.size()-1;
         delete de;
     }
+}
+
+vector<string> Registry::blockStateNames() {
+    vector<string> names(blocks.items.size());
+    for(const auto& [name, state] : blocks.names)
+        names[state] = name;
+    return names;
+}
 
-}
\ No newline at end of file
+void Registry::initHeadless() {
+    registerEnums();
+    registerTextures();
+    registerBlockModels();
+    registerBlocks();
+}
@@ -0,0 +1,126 @@
+#include "resources.hpp"
+#include "jobs.hpp"
+#include "renderer.hpp"
+#include <sstream>
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+// The parts of the registry that need the GL context, only the game links them
+
+GLTexture Registry::finishAtlas(u32* atlasData) {
+    #ifdef DEBUG
+        stbi_write_png("output/atlas_new.png", ATLASTILE*ATLASDIM, ATLASTILE*ATLASDIM, 4, atlasData, ATLASTILE*ATLASDIM*4);
+    #endif
+    // Finally we must flip everything in acordance to OpenGL
+    for(u32 y=0; y<ATLASTILE*ATLASDIM/2; y++) for(u32 x=0; x<ATLASTILE*ATLASDIM; x++) {
+        u32 temp = atlasData[y*ATLASTILE*ATLASDIM+x];
+        atlasData[y*ATLASTILE*ATLASDIM+x] = atlasData[(ATLASDIM*ATLASTILE-y-1)*ATLASTILE*ATLASDIM+x];
+        atlasData[(ATLASDIM*ATLASTILE-y-1)*ATLASTILE*ATLASDIM+x] = temp;
+    };
+    GLTexture tex;
+    tex.height = tex.width = ATLASTILE*ATLASDIM;
+    tex.glid = gl::textureFromMemory((u8*)atlasData, ATLASDIM*ATLASTILE, ATLASDIM*ATLASTILE, 4);
+    free(atlasData);
+    return tex;
+}
+
+void Registry::makeGLTextures(const string &folder) {
+    struct Image {
+        u32 texture;
+        string name;
+        u8* data = nullptr;
+        i32 width = 0, height = 0, channels = 0;
+    };
+    vector<Image> images;
+    for(auto& p : textures.names) {
+        if(p.first.compare(0, folder.size(), folder) != 0)
+            continue;
+        if(p.first.size() < folder.size()+2)
+            continue;
+        images.push_back({ .texture = p.second, .name = p.first });
+    }
+    // decoded on the jobs, the textures are made on this thread since they need the GL context
+    stbi_set_flip_vertically_on_load(false);
+    Jobs::parallelFor("decode texture", images.size(), 1, [&](u32 i) {
+        Image& image = images[i];
+        string filename = "assets/textures/" + image.name + ".png";
+        image.data = stbi_load(filename.c_str(), &image.width, &image.height, &image.channels, 4);
+    });
+    u32 i = 0;
+    for(; i<images.size(); i++) {
+        Image& image = images[i];
+        if(image.data == nullptr)
+            break;
+        if(image.channels != 3 && image.channels != 4)
+            ERR_EXIT("could not do file bohoho " << image.name);
+        u32 glid = gl::textureFromMemory(image.data, image.width, image.height, 4);
+        stbi_image_free(image.data);
+        glTextures.add(image.name, {
+            .glid = glid,
+            .width = (u32)image.width,
+            .height = (u32)image.height,
+            .name = image.name
+        });
+        textures.items[image.texture].usage = TextureRI::GLTEXTURE;
+        textures.items[image.texture].usageID = glTextures.items.size()-1;
+    }
+    for(; i<images.size(); i++)
+        stbi_image_free(images[i].data);
+}
+
+// adds the engine constants right after the #version line
+static string addShaderDefines(const string& source) {
+    std::ostringstream defines;
+    defines << "#define CHUNKSIZE " << Chunk::CHUNKSIZE << "u\n";
+    defines << "#define POS_BITS " << Chunk::POS_BITS << "u\n";
+    u64 lineEnd = source.starts_with("#version") ? source.find('\n') : string::npos;
+    if(lineEnd == string::npos)
+        return defines.str() + source;
+    return source.substr(0, lineEnd+1) + defines.str() + source.substr(lineEnd+1);
+}
+
+void Registry::init() {
+
+    // enums 
+    registerEnums();
+
+    // shaders
+    vector<FileEntry> shadersFES = readFolderRecursively("assets/shaders");
+    for(FileEntry& fe : shadersFES) {
+        if(!fe.hasExtension("glsl"))
+            continue;
+        fe.removeExtension(4);
+        if(!fe.hasExtension("vert"))
+            continue;
+        fe.removeExtension(4);
+        string vertName = "assets/shaders/" + fe.name + ".vert.glsl";
+        string fragName = "assets/shaders/" + fe.name + ".frag.glsl";
+        if(!fileExists(fragName.c_str()))
+            continue;
+        u32 shader = gl::makeProgram(
+            addShaderDefines(readFileString(vertName.c_str())), 
+            addShaderDefines(readFileString(fragName.c_str()))
+        );
+        shaders.add(fe.name, shader);
+    }
+
+    // textures
+    registerTextures();
+
+    // block models
+    registerBlockModels();
+
+    // atlas & textures
+    u32* atlasData = makeAtlas();
+    u32 atlasIndex = 1;
+    addToAtlas(atlasData, atlasIndex, "blocks");
+    glTextures.add("atlas", finishAtlas(atlasData));
+    glTextures.items[glTextures.names["atlas"]].name = "atlas";
+    makeGLTextures("entities");
+
+    // blocks
+    registerBlocks();
+
+    // entity models & entities
+    registerEntities();
+}
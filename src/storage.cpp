@@ -0,0 +1,455 @@
+#include "storage.hpp"
+#include "data.hpp"
+#include "engine.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+    #include <sys/mman.h>
+#endif
+
+// pread or pwrite until everything is moved
+static bool transfer(bool writing, i32 fd, void* data, u64 size, u64 offset) {
+    u8* bytes = (u8*)data;
+    u64 moved = 0;
+    while(moved < size) {
+        i64 n = writing ? pwrite(fd, bytes + moved, size - moved, offset + moved) : pread(fd, bytes + moved, size - moved, offset + moved);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        moved += n;
+    }
+    return true;
+}
+
+static inline u32 sectorsFor(u32 length) {
+    return std::max(1u, (length + RegionFile::SECTOR - 1) / RegionFile::SECTOR);
+}
+
+bool RegionFile::open(const string& path, u32 regionRows) {
+    // always writable, chunks loaded from a region are saved back into it
+    fd = AsyncIO::openFile(path, true);
+    if(fd < 0)
+        return false;
+    rows = regionRows;
+    entries.assign(COLUMNS*COLUMNS*rows, Entry{});
+    headerSectors = (entryOffset(entries.size()) + SECTOR - 1) / SECTOR;
+    used.assign(headerSectors, true);
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close();
+        return false;
+    }
+    u32 header[4];
+    if(st.st_size == 0) {
+        // a new file, every entry is empty
+        header[0] = MAGIC;
+        header[1] = COLUMNS;
+        header[2] = rows;
+        header[3] = 0;
+        if(!transfer(true, fd, header, sizeof(header), 0) || !transfer(true, fd, entries.data(), entries.size()*sizeof(Entry), sizeof(header))) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    if(!transfer(false, fd, header, sizeof(header), 0) || header[0] != MAGIC || header[1] != COLUMNS || header[2] != rows
+        || !transfer(false, fd, entries.data(), entries.size()*sizeof(Entry), sizeof(header))) {
+        Log::error("Region file ", path, " is damaged or made for other world dimensions");
+        close();
+        return false;
+    }
+    for(Entry& e : entries) {
+        if(e.sector == 0)
+            continue;
+        u32 count = sectorsFor(e.length);
+        if(e.sector < headerSectors || e.compression >= COMPRESSION_COUNT || (u64)e.sector*SECTOR + e.length > (u64)st.st_size) {
+            Log::warning("Dropping a damaged chunk entry of region file ", path);
+            e = Entry{};
+            continue;
+        }
+        if(used.size() < e.sector + count)
+            used.resize(e.sector + count, false);
+        std::fill(used.begin() + e.sector, used.begin() + e.sector + count, true);
+    }
+    return true;
+}
+
+void RegionFile::close() {
+    #ifdef __linux__
+        if(mapped)
+            munmap((void*)mapped, mappedSize);
+    #endif
+    mapped = nullptr;
+    mappedSize = 0;
+    AsyncIO::closeFile(fd);
+    fd = -1;
+    entries.clear();
+    used.clear();
+}
+
+u32 RegionFile::allocate(u32 length) {
+    u32 count = sectorsFor(length);
+    // the first free run that is long enough, the end of the file otherwise
+    u32 start = headerSectors, run = 0;
+    for(u32 s=headerSectors; s<used.size() && run < count; s++) {
+        if(used[s]) {
+            start = s+1;
+            run = 0;
+        }
+        else
+            run++;
+    }
+    if(run < count)
+        start = used.size() - run;
+    if(used.size() < start + count)
+        used.resize(start + count, false);
+    std::fill(used.begin() + start, used.begin() + start + count, true);
+    return start;
+}
+
+void RegionFile::release(u32 sector, u32 length) {
+    std::fill(used.begin() + sector, used.begin() + sector + sectorsFor(length), false);
+}
+
+void RegionFile::commit(u32 index, const Entry& entry) {
+    Entry& e = entries[index];
+    if(e.sector != 0)
+        release(e.sector, e.length);
+    e = entry;
+}
+
+const u8* RegionFile::view(u32 index) {
+    const Entry& e = entries[index];
+    if(e.sector == 0)
+        return nullptr;
+    u64 end = (u64)e.sector*SECTOR + e.length;
+    #ifdef __linux__
+        if(end > mappedSize) {
+            // the file grew since it was mapped, the whole file is mapped again
+            struct stat st;
+            if(fstat(fd, &st) != 0 || (u64)st.st_size < end)
+                return nullptr;
+            if(mapped)
+                munmap((void*)mapped, mappedSize);
+            void* memory = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if(memory == MAP_FAILED) {
+                mapped = nullptr;
+                mappedSize = 0;
+                return nullptr;
+            }
+            // neighbours in the file are not neighbours in the world, prefetch says what to read
+            madvise(memory, st.st_size, MADV_RANDOM);
+            mapped = (const u8*)memory;
+            mappedSize = st.st_size;
+        }
+        return mapped + (u64)e.sector*SECTOR;
+    #else
+        (void)end;
+        return nullptr;
+    #endif
+}
+
+bool RegionFile::resident(u32 index) const {
+    #ifdef __linux__
+        const Entry& e = entries[index];
+        u64 start = (u64)e.sector*SECTOR;
+        if(!mapped || e.sector == 0 || start + e.length > mappedSize)
+            return false;
+        u64 page = sysconf(_SC_PAGESIZE);
+        u64 first = start & ~(page-1);
+        u64 pages = (start + e.length - first + page-1) / page;
+        // a few pages at a time, chunks rarely take more than one batch
+        unsigned char resident[64];
+        for(u64 p=0; p<pages; p+=64) {
+            u64 n = std::min<u64>(64, pages - p);
+            if(mincore((void*)(mapped + first + p*page), n*page, resident) != 0)
+                return false;
+            for(u64 i=0; i<n; i++)
+                if(!(resident[i] & 1))
+                    return false;
+        }
+        return true;
+    #else
+        (void)index;
+        return false;
+    #endif
+}
+
+void RegionFile::prefetch(const vector<u32>& indices) {
+    #ifdef __linux__
+        if(!mapped)
+            return;
+        // the sectors of the chunks merged into runs, one madvise per run
+        vector<pair<u64, u64>> runs;
+        for(u32 index : indices) {
+            const Entry& e = entries[index];
+            u64 start = (u64)e.sector*SECTOR;
+            if(e.sector == 0 || start + e.length > mappedSize)
+                continue;
+            runs.push_back({ start, start + e.length });
+        }
+        std::sort(runs.begin(), runs.end());
+        u64 page = sysconf(_SC_PAGESIZE);
+        for(u32 i=0; i<runs.size(); ) {
+            u64 start = runs[i].first & ~(page-1);
+            u64 end = runs[i].second;
+            for(i++; i<runs.size() && runs[i].first <= end + SECTOR; i++)
+                end = std::max(end, runs[i].second);
+            madvise((void*)(mapped + start), end - start, MADV_WILLNEED);
+        }
+    #else
+        (void)indices;
+    #endif
+}
+
+bool WorldStorage::open(const string& worldFolder, ivec2 worldRows) {
+    close();
+    folder = worldFolder;
+    rows = worldRows;
+    bytesRead = 0;
+    bytesWritten = 0;
+    if(makeFolder((folder + "/regions").c_str()))
+        return true;
+    folder.clear();
+    return false;
+}
+
+void WorldStorage::close() {
+    for(auto& [coords, file] : regions) {
+        if(!file)
+            continue;
+        file->close();
+        delete file;
+    }
+    regions.clear();
+}
+
+bool WorldStorage::writeInfo(u64 seed, const vector<string>& states) {
+    DataEntry* info = new DataEntry(DataEntry::MAP);
+    DataEntry* seedEntry = new DataEntry(DataEntry::INT64);
+    seedEntry->seti64((i64)seed);
+    info->dict["seed"] = seedEntry;
+    DataEntry* blocks = new DataEntry(DataEntry::LIST);
+    for(const string& state : states) {
+        DataEntry* name = new DataEntry(DataEntry::STRING);
+        name->str = state;
+        blocks->list.push_back(name);
+    }
+    info->dict["blocks"] = blocks;
+    std::ofstream fout((folder + "/world.td").c_str());
+    if(fout.is_open())
+        info->prettyPrint(fout);
+    DataEntry::deleteTree(info);
+    return fout.is_open() && fout.good();
+}
+
+bool WorldStorage::readInfo(u64& seed, vector<string>& states) const {
+    string path = folder + "/world.td";
+    if(!hasInfo())
+        return false;
+    DataEntry* info = DataEntry::readText(readFileString(path.c_str()));
+    DataEntry* seedEntry = info->type == DataEntry::MAP ? info->schild("seed") : nullptr;
+    bool valid = seedEntry && seedEntry->isInteger();
+    DataEntry* blocks = valid ? info->schild("blocks") : nullptr;
+    if(blocks && !blocks->isListable())
+        valid = false;
+    states.clear();
+    for(u32 i=0; valid && blocks && i<blocks->list.size(); i++) {
+        if(!blocks->list[i]->isStringable()) {
+            valid = false;
+            break;
+        }
+        states.push_back(blocks->list[i]->str);
+    }
+    if(valid)
+        seed = (u64)seedEntry->geti64();
+    else if(seedEntry && seedEntry->isInteger())
+        Log::error("The block states in the world info ", path, " are not a list of names");
+    else if(info->type == DataEntry::ERROR)
+        Log::error("Cannot parse the world info ", path, " at line ", info->error.row, ": ", info->error.message);
+    else
+        Log::error("The world info ", path, " has no seed");
+    DataEntry::deleteTree(info);
+    return valid;
+}
+
+RegionFile* WorldStorage::region(ivec3 coords, bool create) {
+    ivec2 key = RegionFile::regionOf(coords);
+    auto it = regions.find(key);
+    if(it != regions.end() && (it->second || !create))
+        return it->second;
+    // opened here on the calling thread, it happens once per region
+    string path = regionPath(key);
+    RegionFile* file = nullptr;
+    if(create || fileExists(path.c_str())) {
+        file = new RegionFile();
+        if(!file->open(path, rows.y - rows.x)) {
+            Log::error("Cannot open region file ", path);
+            delete file;
+            file = nullptr;
+        }
+    }
+    regions[key] = file;
+    return file;
+}
+
+bool WorldStorage::writeChunk(ivec3 coords, const vector<u8>& bytes, RegionCompression compression) {
+    RegionFile* file = region(coords, true);
+    i32 index = file ? file->indexOf(coords, rows.x) : -1;
+    if(index < 0)
+        return false;
+    RegionFile::Entry entry = { file->allocate(bytes.size()), (u32)bytes.size(), (u32)time(nullptr), compression, {} };
+    if(!transfer(true, file->fd, (void*)bytes.data(), bytes.size(), (u64)entry.sector*RegionFile::SECTOR)
+        || !transfer(true, file->fd, &entry, sizeof(entry), file->entryOffset(index))) {
+        file->release(entry.sector, entry.length);
+        return false;
+    }
+    file->commit(index, entry);
+    bytesWritten += bytes.size();
+    return true;
+}
+
+bool WorldStorage::readChunk(ivec3 coords, vector<u8>& out) {
+    RegionFile* file = region(coords, false);
+    i32 index = file ? file->indexOf(coords, rows.x) : -1;
+    if(index < 0 || file->entries[index].sector == 0)
+        return false;
+    const RegionFile::Entry& e = file->entries[index];
+    out.resize(e.length);
+    if(!transfer(false, file->fd, out.data(), e.length, (u64)e.sector*RegionFile::SECTOR))
+        return false;
+    bytesRead += out.size();
+    return true;
+}
+
+AsyncIO::Awaitable WorldStorage::loadChunk(ivec3 coords) {
+    auto it = writing.find(coords);
+    if(it != writing.end())
+        return AsyncIO::completed(it->second.bytes);
+    RegionFile* file = region(coords, false);
+    i32 index = file ? file->indexOf(coords, rows.x) : -1;
+    if(index < 0 || file->entries[index].sector == 0)
+        return AsyncIO::completed({});
+    const RegionFile::Entry& e = file->entries[index];
+    return AsyncIO::read(file->fd, (u64)e.sector*RegionFile::SECTOR, e.length);
+}
+
+const u8* WorldStorage::mappedChunk(ivec3 coords, u32& size) {
+    // the bytes of a chunk being written are not all in the file yet
+    if(writing.contains(coords))
+        return nullptr;
+    RegionFile* file = region(coords, false);
+    i32 index = file ? file->indexOf(coords, rows.x) : -1;
+    const u8* data = index >= 0 ? file->view(index) : nullptr;
+    // touching pages that are not in memory would wait for the disk on the calling thread
+    if(!data || !file->resident(index))
+        return nullptr;
+    size = file->entries[index].length;
+    return data;
+}
+
+void WorldStorage::prefetch(ivec2 column, i32 radius) {
+    ivec2 low = RegionFile::regionOf({ column.x - radius, 0, column.y - radius });
+    ivec2 high = RegionFile::regionOf({ column.x + radius, 0, column.y + radius });
+    vector<u32> indices;
+    for(i32 rx=low.x; rx<=high.x; rx++) for(i32 rz=low.y; rz<=high.y; rz++) {
+        ivec3 corner = { rx*(i32)RegionFile::COLUMNS, rows.x, rz*(i32)RegionFile::COLUMNS };
+        RegionFile* file = region(corner, false);
+        if(!file)
+            continue;
+        indices.clear();
+        i32 last = -1;
+        for(i32 x=0; x<(i32)RegionFile::COLUMNS; x++) for(i32 z=0; z<(i32)RegionFile::COLUMNS; z++) {
+            ivec2 d = ivec2(corner.x + x, corner.z + z) - column;
+            if(d.x*d.x + d.y*d.y > radius*radius)
+                continue;
+            for(i32 y=rows.x; y<rows.y; y++) {
+                i32 index = file->indexOf({ corner.x + x, y, corner.z + z }, rows.x);
+                if(file->entries[index].sector == 0)
+                    continue;
+                indices.push_back(index);
+                if(last < 0 || file->entries[index].sector > file->entries[last].sector)
+                    last = index;
+            }
+        }
+        // viewing the chunk furthest into the file maps every chunk before it
+        if(last >= 0 && file->view(last))
+            file->prefetch(indices);
+    }
+}
+
+void WorldStorage::saveChunk(ivec3 coords, vector<u8> bytes, RegionCompression compression) {
+    auto it = writing.find(coords);
+    if(it != writing.end() && !it->second.failed) {
+        it->second = { std::move(bytes), compression, true, false };
+        return;
+    }
+    writing[coords] = { std::move(bytes), compression, false, false };
+    writeChunkData(coords);
+}
+
+void WorldStorage::retryFailed() {
+    vector<ivec3> failed;
+    for(const auto& [coords, pending] : writing)
+        if(pending.failed)
+            failed.push_back(coords);
+    for(ivec3 coords : failed) {
+        writing.at(coords).failed = false;
+        writeChunkData(coords);
+    }
+}
+
+// the bytes go into free sectors first and the header entry after, the old bytes stay valid until both are done
+// when either fails the chunk keeps its old entry and the new bytes wait in writing for the next save
+AsyncIO::Task WorldStorage::writeChunkData(ivec3 coords) {
+    while(true) {
+        PendingWrite& pending = writing.at(coords);
+        pending.dirty = false;
+        RegionFile* file = region(coords, true);
+        i32 index = file ? file->indexOf(coords, rows.x) : -1;
+        if(index < 0) {
+            Log::error("Cannot save chunk ", coords.x, " ", coords.y, " ", coords.z, " into ", folder);
+            pending.failed = true;
+            co_return;
+        }
+        u64 size = pending.bytes.size();
+        RegionFile::Entry entry = { file->allocate(size), (u32)size, (u32)time(nullptr), pending.compression, {} };
+        AsyncIO::Request data = co_await AsyncIO::write(file->fd, (u64)entry.sector*RegionFile::SECTOR, pending.bytes);
+        bool written = data.result == (i64)size;
+        if(written) {
+            vector<u8> header(sizeof(entry));
+            memcpy(header.data(), &entry, sizeof(entry));
+            AsyncIO::Request request = co_await AsyncIO::write(file->fd, file->entryOffset(index), std::move(header));
+            written = request.result == sizeof(entry);
+            if(!written)
+                Log::error("Cannot write the header of region file ", regionPath(RegionFile::regionOf(coords)), ": ", request.result < 0 ? strerror(-request.result) : "short write");
+        }
+        else
+            Log::error("Cannot write a chunk into region file ", regionPath(RegionFile::regionOf(coords)), ": ", data.result < 0 ? strerror(-data.result) : "short write");
+        auto it = writing.find(coords);
+        if(written) {
+            file->commit(index, entry);
+            bytesWritten += size;
+        }
+        else
+            file->release(entry.sector, entry.length);
+        if(it->second.dirty)
+            continue;
+        if(written)
+            writing.erase(it);
+        else
+            it->second.failed = true;
+        co_return;
+    }
+}
+
+string WorldStorage::regionPath(ivec2 region) const {
+    return folder + "/regions/r." + std::to_string(region.x) + "." + std::to_string(region.y) + ".region";
+}
@@ -3,16 +3,475 @@
 #include "engine.hpp"
 #include "entity.hpp"
 #include "game.hpp"
+#include "jobs.hpp"
 #include "renderer.hpp"
 #include "resources.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
-#include <glm/ext/scalar_constants.hpp>
+#include <new>
+#include <thread>
+#ifdef __linux__
+    #include <sys/mman.h>
+#endif
 #include <glm/ext/vector_int3.hpp>
 #include <glm/matrix.hpp>
 #include <glm/gtx/norm.hpp>
 
-bool Chunk::inBounds(ivec3 inChunkCoords) {
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+// checks that every word equals the pattern
+static bool wordsEqual(const u64* words, u32 count, u64 pattern) {
+    u32 i = 0;
+    #if defined(__AVX2__)
+        __m256i p = _mm256_set1_epi64x(pattern);
+        for(; i+4 <= count; i+=4) {
+            __m256i diff = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(words+i)), p);
+            if(!_mm256_testz_si256(diff, diff))
+                return false;
+        }
+    #elif defined(__SSE2__)
+        __m128i p = _mm_set1_epi64x(pattern);
+        for(; i+4 <= count; i+=4) {
+            __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(words+i)), p);
+            __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(words+i+2)), p);
+            if(_mm_movemask_epi8(_mm_and_si128(a, b)) != 0xFFFF)
+                return false;
+        }
+    #endif
+    for(; i<count; i++)
+        if(words[i] != pattern)
+            return false;
+    return true;
+}
+
+PalettedArray::PalettedArray(u32 count, u16 value) : count(count), bits(0), bitsLog2(0), indexMask(0), palette({value}), data(1, 0) {}
+
+u32 PalettedArray::paletteIndex(u16 value) {
+    if(bits == 16)
+        return value;
+    for(u32 i=0; i<palette.size(); i++)
+        if(palette[i] == value)
+            return i;
+    palette.push_back(value);
+    if(palette.size() > (1u << bits)) {
+        resize(bitsLog2+1);
+        if(bits == 16)
+            return value;
+    }
+    return palette.size()-1;
+}
+
+void PalettedArray::resize(u8 newBitsLog2) {
+    vector<u64> oldData = std::move(data);
+    u8 oldBits = bits, oldBitsLog2 = bitsLog2;
+    bitsLog2 = newBitsLog2;
+    bits = 1 << newBitsLog2;
+    data.assign(((u64)count*bits+63)/64, 0);
+    for(u32 i=0; i<count; i++) {
+        u32 bit = i << oldBitsLog2;
+        u64 v = (oldData[bit >> 6] >> (bit & 63)) & ((1ull << oldBits) - 1);
+        if(bits == 16)
+            v = palette[v];
+        setRaw(i, v);
+    }
+    if(bits == 16) {
+        palette.clear();
+        palette.shrink_to_fit();
+    }
+}
+
+void PalettedArray::set(u32 index, u16 value) {
+    if(isPacked())
+        unpack();
+    if(bits == 0) {
+        if(palette[0] == value)
+            return;
+        // promote back to the smallest full storage
+        bits = 1;
+        bitsLog2 = 0;
+        indexMask = ~0u;
+        data.assign((count+63)/64, 0);
+    }
+    setRaw(index, paletteIndex(value));
+}
+
+void PalettedArray::fill(u16 value) {
+    bits = 0;
+    bitsLog2 = 0;
+    indexMask = 0;
+    palette = { value };
+    palette.shrink_to_fit();
+    data.assign(1, 0);
+    data.shrink_to_fit();
+    packed.clear();
+    packed.shrink_to_fit();
+}
+
+bool PalettedArray::makeUniform() {
+    if(bits == 0)
+        return true;
+    if(isPacked())
+        unpack();
+    u64 first = data[0] & ((1ull << bits) - 1);
+    u64 pattern = first;
+    for(u32 b=bits; b<64; b<<=1)
+        pattern |= pattern << b;
+    if(!wordsEqual(data.data(), ((u64)count*bits)/64, pattern))
+        return false;
+    fill(bits == 16 ? (u16)first : palette[first]);
+    return true;
+}
+
+void PalettedArray::repack() {
+    unpack();
+    vector<u16> values(count);
+    for(u32 i=0; i<count; i++)
+        values[i] = get(i);
+    vector<u16> newPalette = values;
+    std::sort(newPalette.begin(), newPalette.end());
+    newPalette.erase(std::unique(newPalette.begin(), newPalette.end()), newPalette.end());
+    if(newPalette.size() == 1) {
+        fill(newPalette[0]);
+        return;
+    }
+    // the smallest width that fits the palette, anything above 8 bits stores the values directly
+    u8 newBitsLog2 = 0;
+    while(newBitsLog2 < 4 && (1u << (1 << newBitsLog2)) < newPalette.size())
+        newBitsLog2++;
+    bitsLog2 = newBitsLog2;
+    bits = 1 << newBitsLog2;
+    indexMask = ~0u;
+    data.assign(((u64)count*bits+63)/64, 0);
+    data.shrink_to_fit();
+    if(bits == 16) {
+        palette.clear();
+        palette.shrink_to_fit();
+        for(u32 i=0; i<count; i++)
+            setRaw(i, values[i]);
+        return;
+    }
+    palette = newPalette;
+    for(u32 i=0; i<count; i++)
+        setRaw(i, std::lower_bound(palette.begin(), palette.end(), values[i]) - palette.begin());
+}
+
+static void writeVarint(vector<u8>& out, u32 v) {
+    while(v >= 0x80) {
+        out.push_back((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(v);
+}
+
+static u32 readVarint(const u8*& in) {
+    u32 v = 0;
+    for(u32 shift=0; ; shift+=7) {
+        u8 b = *in++;
+        v |= (u32)(b & 0x7F) << shift;
+        if(!(b & 0x80))
+            return v;
+    }
+}
+
+// the packed form is a list of tokens, a varint (n << 1 | isRun) followed by
+// one word repeated n times for runs or by n words for literals
+bool PalettedArray::pack() {
+    if(bits == 0 || isPacked())
+        return false;
+    vector<u8> out;
+    u32 words = data.size();
+    u32 literalStart = 0;
+    auto flushLiterals = [&](u32 end) {
+        if(end == literalStart) return;
+        writeVarint(out, (end-literalStart) << 1);
+        size_t at = out.size();
+        out.resize(at + (end-literalStart)*sizeof(u64));
+        memcpy(out.data() + at, data.data() + literalStart, (end-literalStart)*sizeof(u64));
+    };
+    for(u32 i=0; i<words; ) {
+        u32 run = 1;
+        while(i+run < words && data[i+run] == data[i])
+            run++;
+        if(run < 2) {
+            i++;
+            continue;
+        }
+        flushLiterals(i);
+        writeVarint(out, (run << 1) | 1);
+        size_t at = out.size();
+        out.resize(at + sizeof(u64));
+        memcpy(out.data() + at, &data[i], sizeof(u64));
+        i += run;
+        literalStart = i;
+    }
+    flushLiterals(words);
+    if(out.size() >= words*sizeof(u64))
+        return false;
+    out.shrink_to_fit();
+    packed = std::move(out);
+    data.clear();
+    data.shrink_to_fit();
+    return true;
+}
+
+void PalettedArray::unpack() {
+    if(!isPacked())
+        return;
+    data.resize(unpackedSize()/sizeof(u64));
+    const u8* in = packed.data();
+    const u8* end = in + packed.size();
+    u64* out = data.data();
+    while(in < end) {
+        u32 token = readVarint(in);
+        u32 n = token >> 1;
+        if(token & 1) {
+            u64 word;
+            memcpy(&word, in, sizeof(u64));
+            in += sizeof(u64);
+            std::fill(out, out+n, word);
+        }
+        else {
+            memcpy(out, in, n*sizeof(u64));
+            in += n*sizeof(u64);
+        }
+        out += n;
+    }
+    packed.clear();
+    packed.shrink_to_fit();
+}
+
+u64 PalettedArray::packedWord(u32 word) const {
+    const u8* in = packed.data();
+    for(u32 first=0; ; ) {
+        u32 token = readVarint(in);
+        u32 n = token >> 1;
+        if(word < first+n) {
+            u64 v;
+            memcpy(&v, (token & 1) ? in : in + (word-first)*sizeof(u64), sizeof(u64));
+            return v;
+        }
+        in += (token & 1) ? sizeof(u64) : n*sizeof(u64);
+        first += n;
+    }
+}
+
+u32 PalettedArray::memoryUsage() const {
+    return sizeof(PalettedArray) + palette.capacity()*sizeof(u16) + data.capacity()*sizeof(u64) + packed.capacity();
+}
+
+// whether every entry of the words has a palette entry, bits is below 16
+static bool entriesInPalette(const u8* words, u32 count, u8 bits, u32 paletteSize) {
+    if(paletteSize >= (1u << bits))
+        return true;
+    for(u32 w=0; w<count; w++) {
+        u64 word;
+        memcpy(&word, words + w*sizeof(u64), sizeof(u64));
+        for(u32 bit=0; bit<64; bit+=bits)
+            if(((word >> bit) & ((1ull << bits) - 1)) >= paletteSize)
+                return false;
+    }
+    return true;
+}
+
+bool PalettedArray::remap(const vector<u16>& values) {
+    if(bits < 16) {
+        for(u16& v : palette) {
+            if(v >= values.size())
+                return false;
+            v = values[v];
+        }
+        return true;
+    }
+    // the values are stored directly
+    bool wasPacked = isPacked();
+    unpack();
+    for(u32 i=0; i<count; i++) {
+        u16 v = get(i);
+        if(v >= values.size())
+            return false;
+        setRaw(i, values[v]);
+    }
+    if(wasPacked)
+        pack();
+    return true;
+}
+
+// bits, palette size, palette, whether it is packed, size of the data and the data
+void PalettedArray::serialize(vector<u8>& out) const {
+    auto append = [&](const void* bytes, u64 size) {
+        out.insert(out.end(), (const u8*)bytes, (const u8*)bytes + size);
+    };
+    u16 paletteSize = palette.size();
+    u8 isPacked = this->isPacked();
+    u32 size = isPacked ? packed.size() : data.size()*sizeof(u64);
+    append(&bits, 1);
+    append(&paletteSize, sizeof(u16));
+    append(palette.data(), paletteSize*sizeof(u16));
+    append(&isPacked, 1);
+    append(&size, sizeof(u32));
+    append(isPacked ? (const void*)packed.data() : (const void*)data.data(), size);
+}
+
+bool PalettedArray::deserialize(const u8*& in, const u8* end) {
+    auto read = [&](void* bytes, u64 size) {
+        if((u64)(end-in) < size)
+            return false;
+        memcpy(bytes, in, size);
+        in += size;
+        return true;
+    };
+    u8 newBits, isPacked;
+    u16 paletteSize;
+    u32 size;
+    if(!read(&newBits, 1) || (newBits != 0 && !std::has_single_bit((u32)newBits)) || newBits > 16 || !read(&paletteSize, sizeof(u16)))
+        return false;
+    if(newBits == 16 ? paletteSize != 0 : (paletteSize == 0 || paletteSize > (newBits == 0 ? 1u : 1u << newBits)))
+        return false;
+    vector<u16> newPalette(paletteSize);
+    if(!read(newPalette.data(), paletteSize*sizeof(u16)) || !read(&isPacked, 1) || !read(&size, sizeof(u32)) || (u64)(end-in) < size)
+        return false;
+    bits = newBits;
+    bitsLog2 = bits == 0 ? 0 : std::countr_zero((u32)bits);
+    indexMask = bits == 0 ? 0 : ~0u;
+    palette = std::move(newPalette);
+    u32 words = bits == 0 ? 1 : unpackedSize()/sizeof(u64);
+    bool checkEntries = bits > 0 && bits < 16;
+    if(!isPacked) {
+        if(size != words*sizeof(u64) || (checkEntries && !entriesInPalette(in, words, bits, palette.size())))
+            return false;
+        data.resize(words);
+        memcpy(data.data(), in, size);
+        packed.clear();
+        in += size;
+        return true;
+    }
+    // the tokens are checked here so that unpack can trust them
+    const u8* token = in;
+    const u8* tokensEnd = in + size;
+    u32 total = 0;
+    while(token < tokensEnd) {
+        u32 v = 0;
+        for(u32 shift=0; ; shift+=7) {
+            if(token == tokensEnd || shift > 28)
+                return false;
+            u8 b = *token++;
+            v |= (u32)(b & 0x7F) << shift;
+            if(!(b & 0x80))
+                break;
+        }
+        u32 n = v >> 1;
+        u64 bytes = (v & 1) ? sizeof(u64) : (u64)n*sizeof(u64);
+        if(n == 0 || (u64)(tokensEnd-token) < bytes || total + (u64)n > words)
+            return false;
+        if(checkEntries && !entriesInPalette(token, bytes/sizeof(u64), bits, palette.size()))
+            return false;
+        token += bytes;
+        total += n;
+    }
+    if(bits == 0 || total != words)
+        return false;
+    packed.assign(in, tokensEnd);
+    data.clear();
+    data.shrink_to_fit();
+    in = tokensEnd;
+    return true;
+}
+
+template<u32 SIZE>
+void ChunkT<SIZE>::compact() {
+    if(!blocks.makeUniform())
+        blocks.repack();
+    if(!lightlevels.makeUniform())
+        lightlevels.repack();
+}
+
+template<u32 SIZE>
+void ChunkT<SIZE>::fill(blockID block) {
+    blocks.fill(block);
+    revision++;
+    for(u64& mask : brickMask)
+        mask = 0;
+    if(block == 0) {
+        brickVoxels.clear();
+        brickVoxels.shrink_to_fit();
+        occupiedBricks = 0;
+        return;
+    }
+    brickVoxels.assign(BRICK_COUNT, ~0ull);
+    for(u32 brick=0; brick<BRICK_COUNT; brick++)
+        brickMask[brick >> 6] |= 1ull << (brick & 63);
+    occupiedBricks = BRICK_COUNT;
+}
+
+template<u32 SIZE>
+u32 ChunkT<SIZE>::memoryUsage() const {
+    return blocks.memoryUsage() + lightlevels.memoryUsage() + brickVoxels.capacity()*sizeof(u64);
+}
+
+// a version byte, then the blocks and the light
+template<u32 SIZE>
+void ChunkT<SIZE>::serialize(vector<u8>& out, const vector<u16>* states) const {
+    out.push_back(1);
+    if(states) {
+        PalettedArray saved = blocks;
+        saved.remap(*states);
+        saved.serialize(out);
+    }
+    else
+        blocks.serialize(out);
+    lightlevels.serialize(out);
+}
+
+template<u32 SIZE>
+bool ChunkT<SIZE>::deserialize(const u8* data, u64 size, const vector<u16>* states) {
+    const u8* in = data;
+    const u8* end = data + size;
+    fill(0);
+    lightlevels.fill(0);
+    if(size == 0 || *in++ != 1 || !blocks.deserialize(in, end) || !lightlevels.deserialize(in, end) || in != end
+        || (states && !blocks.remap(*states))) {
+        fill(0);
+        lightlevels.fill(0);
+        return false;
+    }
+    // the occupancy is not stored, it is rebuilt while checking the ids against the registry
+    u32 stateCount = Registry::blocks.items.size();
+    if(blocks.isUniform()) {
+        blockID block = blocks.palette[0];
+        blocks.fill(0);
+        if(block >= stateCount)
+            return false;
+        fill(block);
+        return true;
+    }
+    bool packed = blocks.isPacked();
+    blocks.unpack();
+    bool valid = true;
+    Layout::forEach([&](ivec3 p, u32 i) {
+        blockID block = blocks.get(i);
+        valid &= block < stateCount;
+        if(block != 0)
+            setOccupied(p, true);
+    });
+    if(!valid) {
+        fill(0);
+        lightlevels.fill(0);
+        return false;
+    }
+    if(packed)
+        blocks.pack();
+    revision++;
+    return true;
+}
+
+template<u32 SIZE>
+bool ChunkT<SIZE>::inBounds(ivec3 inChunkCoords) {
     return !(
         inChunkCoords.x < 0 || inChunkCoords.x >= (i32)CHUNKSIZE || 
         inChunkCoords.y < 0 || inChunkCoords.y >= (i32)CHUNKSIZE ||
@@ -20,106 +479,1110 @@ bool Chunk::inBounds(ivec3 inChunkCoords) {
     );
 }
 
-u32 Chunk::indexOf(ivec3 inChunkCoords) {
-    return inChunkCoords.x + inChunkCoords.z*CHUNKSIZE + inChunkCoords.y*CHUNKSIZE*CHUNKSIZE;
-}
-
-vec3 harmonics[] = { {4.0f, 0.1f, 0.1f}, {2.0f, 0.2f, 0.2f}, {1.0f, 0.3f, 0.5f}, {1.0f, 0.5f, 0.3f} };
-vec2 offsets[] = { {}, {}, {}, {} };
-
-void Chunk::makeSin(ivec3 coords) {
-    if(offsets[0].x == 0)
-        for(u32 i=0; i<4; i++) {
-            offsets[i].x = (f32)rand()/(f32)RAND_MAX;
-            offsets[i].y = (f32)rand()/(f32)RAND_MAX;
-        }
-    for(u32 x=0; x<CHUNKSIZE; x++) for(u32 z=0; z<CHUNKSIZE; z++) {
-        f32 heightf = 15.0f;
-        for(u32 i=0; i<4; i++) {
-            vec2 pos = vec2((f32)(coords.x*(i32)CHUNKSIZE+(i32)x), (f32)(coords.z*(i32)CHUNKSIZE+(i32)z));
-            pos += offsets[i] * 2.0f * glm::pi<f32>();
-            f32 v = harmonics[i].x * cosf(harmonics[i].y*pos.x) * cosf(harmonics[i].z*pos.y);
-            heightf += v;
-        }
-        u32 height = heightf;
-        for(u32 y=0; y<CHUNKSIZE; y++) {
-            u32 i = indexOf({x, y, z});
-            f32 r = (f32)rand()/(f32)RAND_MAX;
-            if(y < height-4) {
-                if(r < 0.1) blocks[i] = Registry::blocks.names["cobblestone"];
-                else blocks[i] = Registry::blocks.names["stone"];
-            } else if(y < height)
-                blocks[i] = Registry::blocks.names["dirt"];
-            else if(y == height) {
-                if(r < 0.35) blocks[i] = Registry::blocks.names["sand"];
-                //else if(r < 0.4) blocks[i] = Registry::blocks.names["red_sand"];
-                else if(r < 0.45) blocks[i] = Registry::blocks.names["dirt"];
-                else blocks[i] = Registry::blocks.names["grass"];
+template<u32 SIZE>
+void ChunkT<SIZE>::makeRandom() {
+    Layout::forEach([&](ivec3 p, u32 i) {
+        f32 r = (f32)rand()/(f32)RAND_MAX;
+        if(r > (f32)p.y/(f32)CHUNKSIZE)
+            setBlock(i, rand() % (Registry::blocks.items.size()-1) + 1);
+        else
+            setBlock(i, 0);
+    });
+    compact();
+}
+
+template<u32 SIZE>
+void ChunkT<SIZE>::makeVoxelMesh(VoxelMesh& mesh, ChunkT* neighbours[6]) const {
+
+    BlockModel::DrawInfo di = { mesh, *this, { 
+        neighbours[0], neighbours[1], neighbours[2], 
+        neighbours[3], neighbours[4], neighbours[5]
+    }, {0,0,0} };
+    if(isUniform()) {
+        blockID block = getBlock(0);
+        if(block == 0)
+            return;
+        BlockModel* model = Registry::blocks.items[block]->model;
+        if(!model)
+            return;
+        // a fully solid chunk can only have faces on its boundary
+        if(Registry::blocks.items[block]->solidity == 0b111111) {
+            for(di.blockPos.x=0; di.blockPos.x<(i32)CHUNKSIZE; di.blockPos.x++)
+            for(di.blockPos.z=0; di.blockPos.z<(i32)CHUNKSIZE; di.blockPos.z++) {
+                bool edge = di.blockPos.x == 0 || di.blockPos.x == (i32)CHUNKSIZE-1 || di.blockPos.z == 0 || di.blockPos.z == (i32)CHUNKSIZE-1;
+                for(di.blockPos.y=0; di.blockPos.y<(i32)CHUNKSIZE; di.blockPos.y += edge ? 1 : (i32)CHUNKSIZE-1)
+                    model->addToMesh(di);
+            }
+            return;
+        }
+    }
+    //mesh.vertices, mesh.indices;
+    Layout::forEach([&](ivec3 p, u32 i) {
+        blockID block = getBlock(i);
+        if(block == 0)
+            return;
+        BlockModel* model = Registry::blocks.items[block]->model;
+        if(!model)
+            return;
+        di.blockPos = p;
+        model->addToMesh(di);
+    });
+}
+
+template struct ChunkT<CHUNK_SIZE>;
+
+ChunkPool::ChunkPool(u32 slabChunks, bool hugePages) : slabChunks(slabChunks), hugePages(hugePages), nextSlot(0) {}
+
+void ChunkPool::addSlab() {
+    Slab slab = { nullptr, slabChunks*SLOT_SIZE, false };
+    #ifdef __linux__
+        if(hugePages) {
+            constexpr u64 HUGE_PAGE = 2*1024*1024;
+            slab.size = (slab.size + HUGE_PAGE-1) & ~(HUGE_PAGE-1);
+            void* memory = mmap(nullptr, slab.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            // no reserved huge pages, ask for transparent ones instead
+            if(memory == MAP_FAILED) {
+                memory = mmap(nullptr, slab.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(memory != MAP_FAILED)
+                    madvise(memory, slab.size, MADV_HUGEPAGE);
             }
-            else 
-                blocks[i] = 0;
-            if(x == CHUNKSIZE/2 && z == CHUNKSIZE/2) {
-                if(y > height && y < height+10)
-                    blocks[i] = Registry::blocks.names["log/y"];
+            if(memory != MAP_FAILED) {
+                slab.memory = (u8*)memory;
+                slab.mapped = true;
             }
         }
-        
+    #endif
+    if(!slab.memory)
+        slab.memory = (u8*)aligned_alloc(64, slab.size);
+    if(!slab.memory)
+        ERR_EXIT("Could not allocate a chunk slab of " << slab.size << " bytes");
+    slabs.push_back(slab);
+    nextSlot = 0;
+    stats.slabs++;
+    stats.capacity += slabChunks;
+    stats.reservedBytes += slab.size;
+}
+
+WorldChunk* ChunkPool::acquire(ivec3 coords) {
+    WorldChunk* wc;
+    if(!freeChunks.empty()) {
+        wc = freeChunks.back();
+        freeChunks.pop_back();
+        wc->coords = coords;
+        stats.free--;
+        stats.recycled++;
+    }
+    else {
+        if(slabs.empty() || nextSlot == slabChunks)
+            addSlab();
+        wc = new(slabs.back().memory + nextSlot*SLOT_SIZE) WorldChunk(coords);
+        nextSlot++;
     }
+    wc->mesh.chunkCoords = coords;
+    stats.used++;
+    stats.acquired++;
+    return wc;
+}
 
+void ChunkPool::release(WorldChunk* wc) {
+    wc->releases.fetch_add(1, std::memory_order_release);
+    wc->reset();
+    freeChunks.push_back(wc);
+    stats.used--;
+    stats.free++;
 }
 
-void Chunk::makeRandom() {
-    for(u32 x=0; x<CHUNKSIZE; x++)
-    for(u32 z=0; z<CHUNKSIZE; z++)
-    for(u32 y=0; y<CHUNKSIZE; y++) {
-        u32 i = indexOf({x, y, z});
-        f32 r = (f32)rand()/(f32)RAND_MAX;
-        if(r > (f32)y/(f32)CHUNKSIZE)
-            blocks[i] = rand() % (Registry::blocks.items.size()-1) + 1;
+void ChunkPool::destroy() {
+    for(u32 i=0; i<slabs.size(); i++) {
+        u32 constructed = i+1 == slabs.size() ? nextSlot : slabChunks;
+        for(u32 slot=0; slot<constructed; slot++)
+            ((WorldChunk*)(slabs[i].memory + slot*SLOT_SIZE))->~WorldChunk();
+        #ifdef __linux__
+            if(slabs[i].mapped) {
+                munmap(slabs[i].memory, slabs[i].size);
+                continue;
+            }
+        #endif
+        free(slabs[i].memory);
+    }
+    slabs.clear();
+    freeChunks.clear();
+    nextSlot = 0;
+    stats = Stats();
+}
+
+Epochs::Guard::Guard(Epochs& epochs) : epochs(epochs) {
+    u64 epoch = epochs.global.load();
+    // the readers of different threads start looking at different slots
+    slot = std::hash<std::thread::id>()(std::this_thread::get_id()) % MAX_READERS;
+    for(u64 expected = 0; !epochs.readers[slot].epoch.compare_exchange_weak(expected, epoch); expected = 0)
+        slot = (slot + 1) % MAX_READERS;
+    // the owner can retire between the load and the slot being taken, then the newer epoch is announced
+    for(u64 now = epochs.global.load(); now != epoch; now = epochs.global.load()) {
+        epoch = now;
+        epochs.readers[slot].epoch.store(epoch);
+    }
+}
+
+Epochs::Guard::~Guard() {
+    epochs.readers[slot].epoch.store(0, std::memory_order_release);
+}
+
+void Epochs::retire(std::function<void()> free) {
+    // readers that enter from now on see the new epoch and cannot find the object
+    retired.push_back({ global.fetch_add(1), std::move(free) });
+}
+
+u32 Epochs::collect() {
+    if(retired.empty())
+        return 0;
+    u64 oldest = UINT64_MAX;
+    for(const Reader& reader : readers) {
+        u64 epoch = reader.epoch.load();
+        if(epoch != 0)
+            oldest = std::min(oldest, epoch);
+    }
+    u32 n = 0;
+    while(n < retired.size() && retired[n].epoch < oldest)
+        retired[n++].free();
+    retired.erase(retired.begin(), retired.begin() + n);
+    freed += n;
+    return n;
+}
+
+void Epochs::drain() {
+    while(true) {
+        collect();
+        if(retired.empty())
+            return;
+        std::this_thread::yield();
+    }
+}
+
+ChunkDirectory::ChunkDirectory(u32 capacity) {
+    Table* t = new Table { std::bit_ceil(capacity) - 1, new std::atomic<WorldChunk*>[std::bit_ceil(capacity)] };
+    for(u32 i=0; i<=t->mask; i++)
+        t->slots[i].store(nullptr, std::memory_order_relaxed);
+    table.store(t);
+}
+
+ChunkDirectory::~ChunkDirectory() {
+    epochs.drain();
+    Table* t = table.load();
+    delete[] t->slots;
+    delete t;
+}
+
+WorldChunk* ChunkDirectory::find(const Epochs::Guard& guard, ivec3 coords) const {
+    (void)guard;
+    const Table* t = table.load(std::memory_order_acquire);
+    // the table is never more than half full, so every probe reaches an empty slot
+    for(u32 i = hashOf(coords) & t->mask; ; i = (i+1) & t->mask) {
+        WorldChunk* wc = t->slots[i].load(std::memory_order_acquire);
+        if(!wc)
+            return nullptr;
+        if(wc != tombstone() && wc->coords == coords)
+            return wc;
+    }
+}
+
+void ChunkDirectory::insert(WorldChunk* wc) {
+    Table* t = table.load(std::memory_order_relaxed);
+    if((count + tombstones + 1)*2 > t->mask+1) {
+        rebuild(std::max(t->mask+1, std::bit_ceil((count+1)*4)));
+        t = table.load(std::memory_order_relaxed);
+    }
+    for(u32 i = hashOf(wc->coords) & t->mask; ; i = (i+1) & t->mask) {
+        WorldChunk* old = t->slots[i].load(std::memory_order_relaxed);
+        if(old && old != tombstone())
+            continue;
+        if(old)
+            tombstones--;
+        t->slots[i].store(wc, std::memory_order_release);
+        count++;
+        return;
+    }
+}
+
+void ChunkDirectory::remove(WorldChunk* wc) {
+    Table* t = table.load(std::memory_order_relaxed);
+    for(u32 i = hashOf(wc->coords) & t->mask; ; i = (i+1) & t->mask) {
+        WorldChunk* found = t->slots[i].load(std::memory_order_relaxed);
+        if(!found)
+            return;
+        if(found != wc)
+            continue;
+        // a tombstone keeps the probes of the chunks behind it going
+        t->slots[i].store(tombstone(), std::memory_order_release);
+        count--;
+        tombstones++;
+        return;
+    }
+}
+
+void ChunkDirectory::rebuild(u32 capacity) {
+    Table* old = table.load(std::memory_order_relaxed);
+    Table* t = new Table { capacity - 1, new std::atomic<WorldChunk*>[capacity] };
+    for(u32 i=0; i<capacity; i++)
+        t->slots[i].store(nullptr, std::memory_order_relaxed);
+    for(u32 j=0; j<=old->mask; j++) {
+        WorldChunk* wc = old->slots[j].load(std::memory_order_relaxed);
+        if(!wc || wc == tombstone())
+            continue;
+        u32 i = hashOf(wc->coords) & t->mask;
+        while(t->slots[i].load(std::memory_order_relaxed))
+            i = (i+1) & t->mask;
+        t->slots[i].store(wc, std::memory_order_relaxed);
+    }
+    table.store(t, std::memory_order_release);
+    tombstones = 0;
+    epochs.retire([old]() {
+        delete[] old->slots;
+        delete old;
+    });
+}
+
+ChunkGrid::ChunkGrid(ivec3 dims) : dims(dims), center(0, 0, 0), cells(dims.x*dims.y*dims.z, nullptr) {}
+
+void ChunkGrid::insert(WorldChunk* wc) {
+    if(inWindow(wc->coords))
+        cells[cellOf(wc->coords)] = wc;
+    else
+        far[wc->coords] = wc;
+    wc->gridIndex = loaded.size();
+    loaded.push_back(wc);
+    directory.insert(wc);
+    for(u32 dir=0; dir<DIRECTION_COUNT; dir++) {
+        WorldChunk* n = get(wc->coords + directionVector[dir]);
+        wc->neighbours[dir] = n;
+        if(n) n->neighbours[directionOpposite[dir]] = wc;
+    }
+}
+
+WorldChunk* ChunkGrid::remove(ivec3 coords) {
+    WorldChunk* wc = get(coords);
+    if(!wc) return nullptr;
+    if(inWindow(coords))
+        cells[cellOf(coords)] = nullptr;
+    else
+        far.erase(coords);
+    loaded[wc->gridIndex] = loaded.back();
+    loaded[wc->gridIndex]->gridIndex = wc->gridIndex;
+    loaded.pop_back();
+    directory.remove(wc);
+    for(u32 dir=0; dir<DIRECTION_COUNT; dir++) {
+        if(wc->neighbours[dir])
+            wc->neighbours[dir]->neighbours[directionOpposite[dir]] = nullptr;
+        wc->neighbours[dir] = nullptr;
+    }
+    return wc;
+}
+
+void ChunkGrid::release(WorldChunk* wc, ChunkPool& pool) {
+    directory.epochs.retire([wc, &pool]() { pool.release(wc); });
+}
+
+void ChunkGrid::recenter(ivec3 newCenter) {
+    if(newCenter == center) return;
+    // a cell is reused by the chunk one window away, so the chunks that leave
+    // have to go to the far map before the ones that enter take their cells
+    vector<WorldChunk*> entering;
+    for(auto it = far.begin(); it != far.end(); ) {
+        ivec3 d = it->first - newCenter + dims/2;
+        if((u32)d.x < (u32)dims.x && (u32)d.y < (u32)dims.y && (u32)d.z < (u32)dims.z) {
+            entering.push_back(it->second);
+            it = far.erase(it);
+        }
+        else ++it;
+    }
+    center = newCenter;
+    for(WorldChunk*& cell : cells)
+        if(cell && !inWindow(cell->coords)) {
+            far[cell->coords] = cell;
+            cell = nullptr;
+        }
+    for(WorldChunk* wc : entering)
+        cells[cellOf(wc->coords)] = wc;
+}
+
+void BlockAccessor::moveTo(ivec3 newChunk) {
+    ivec3 d = newChunk - chunkCoords;
+    chunkCoords = newChunk;
+    if(wc && std::abs(d.x) + std::abs(d.y) + std::abs(d.z) == 1) {
+        for(u32 dir=0; dir<DIRECTION_COUNT; dir++)
+            if(directionVector[dir] == d) {
+                wc = wc->neighbours[dir];
+                if(wc && !wc->ready())
+                    wc = nullptr;
+                return;
+            }
+    }
+    wc = grid->get(newChunk);
+    if(wc && !wc->ready())
+        wc = nullptr;
+}
+
+void BlockAccessor::markChanged(WorldChunk* c, ivec3 lo, ivec3 hi) {
+    c->needsRemeshing = true;
+    for(u32 dir=0; dir<DIRECTION_COUNT; dir++) {
+        ivec2 as = directionToAxisAndSign[dir];
+        bool onFace = as.y > 0 ? hi[as.x] == S-1 : lo[as.x] == 0;
+        if(onFace && c->neighbours[dir])
+            c->neighbours[dir]->needsRemeshing = true;
+    }
+}
+
+bool BlockAccessor::set(ivec3 blockPos, Chunk::blockID block) {
+    WorldChunk* c = chunkOf(blockPos);
+    if(!c)
+        return false;
+    ivec3 local = blockPos & (S-1);
+    u32 index = Chunk::indexOf(local);
+    if(c->chunk.getBlock(index) == block)
+        return true;
+    c->chunk.setBlock(index, block);
+    markChanged(c, local, local);
+    updateColumns(blockPos, blockPos);
+    return true;
+}
+
+i32 BlockAccessor::highestSolid(i32 x, i32 z, i32 fromY) {
+    i32 y = fromY;
+    while(true) {
+        WorldChunk* c = chunkOf({x, y, z});
+        if(!c)
+            return y | (S-1);
+        ivec3 local = ivec3(x, y, z) & (S-1);
+        // skip empty chunks and bricks at once
+        if(c->chunk.isEmpty())
+            y = (y & ~(S-1)) - 1;
+        else if(!c->chunk.isBrickOccupied(Chunk::brickOf(local)))
+            y = (y & ~3) - 1;
+        else if(c->chunk.isOccupied(local))
+            return y;
         else
-            blocks[i] = 0;
-    };
+            y--;
+    }
 }
 
-void Chunk::makeVoxelMesh(VoxelMesh& mesh, Chunk* neighbours[6]) const {
+void BlockAccessor::updateColumns(ivec3 from, ivec3 to) {
+    if(!columns)
+        return;
+    for(i32 cz=from.z >> (i32)Chunk::SIZE_LOG2; cz<=to.z >> (i32)Chunk::SIZE_LOG2; cz++)
+    for(i32 cx=from.x >> (i32)Chunk::SIZE_LOG2; cx<=to.x >> (i32)Chunk::SIZE_LOG2; cx++) {
+        ChunkColumn* column = columns->find({cx, cz});
+        if(!column)
+            continue;
+        ivec3 lo = glm::max(from, ivec3(cx*S, 0, cz*S));
+        ivec3 hi = glm::min(to, ivec3(cx*S+S-1, 0, cz*S+S-1));
+        for(i32 z=lo.z; z<=hi.z; z++) for(i32 x=lo.x; x<=hi.x; x++) {
+            i32& top = column->topSolid[ChunkColumn::indexOf({x, 0, z})];
+            // the blocks above the changed ones are as they were
+            if(top <= to.y)
+                top = highestSolid(x, z, to.y);
+        }
+    }
+}
 
-    BlockModel::DrawInfo di = { mesh, *this, { 
-        neighbours[0], neighbours[1], neighbours[2], 
-        neighbours[3], neighbours[4], neighbours[5]
-    }, {0,0,0} };
-    //mesh.vertices, mesh.indices;
-    for(di.blockPos.x=0; di.blockPos.x<(i32)CHUNKSIZE; di.blockPos.x++)
-    for(di.blockPos.z=0; di.blockPos.z<(i32)CHUNKSIZE; di.blockPos.z++)
-    for(di.blockPos.y=0; di.blockPos.y<(i32)CHUNKSIZE; di.blockPos.y++) {
-        u32 i = indexOf(di.blockPos);
-        if(blocks[i] == 0)
+void BlockAccessor::readRegion(ivec3 from, ivec3 to, Chunk::blockID* out) {
+    ivec3 size = to - from + 1;
+    ivec3 fromChunk = from >> (i32)Chunk::SIZE_LOG2;
+    ivec3 toChunk = to >> (i32)Chunk::SIZE_LOG2;
+    for(i32 cy=fromChunk.y; cy<=toChunk.y; cy++)
+    for(i32 cz=fromChunk.z; cz<=toChunk.z; cz++)
+    for(i32 cx=fromChunk.x; cx<=toChunk.x; cx++) {
+        ivec3 base = ivec3(cx, cy, cz) * S;
+        WorldChunk* c = chunkOf(base);
+        ivec3 lo = glm::max(from - base, ivec3(0));
+        ivec3 hi = glm::min(to - base, ivec3(S-1));
+        bool uniform = !c || c->chunk.isUniform();
+        Chunk::blockID value = c ? c->chunk.getBlock(0) : 0;
+        for(i32 y=lo.y; y<=hi.y; y++) for(i32 z=lo.z; z<=hi.z; z++) {
+            Chunk::blockID* row = out + (base.x+lo.x-from.x) + ((base.z+z-from.z) + (base.y+y-from.y)*size.z)*size.x;
+            if(uniform)
+                std::fill(row, row + hi.x-lo.x+1, value);
+            else for(i32 x=lo.x; x<=hi.x; x++)
+                row[x-lo.x] = c->chunk.getBlock(Chunk::indexOf({x, y, z}));
+        }
+    }
+}
+
+void BlockAccessor::writeRegion(ivec3 from, ivec3 to, const Chunk::blockID* in) {
+    ivec3 size = to - from + 1;
+    ivec3 fromChunk = from >> (i32)Chunk::SIZE_LOG2;
+    ivec3 toChunk = to >> (i32)Chunk::SIZE_LOG2;
+    for(i32 cy=fromChunk.y; cy<=toChunk.y; cy++)
+    for(i32 cz=fromChunk.z; cz<=toChunk.z; cz++)
+    for(i32 cx=fromChunk.x; cx<=toChunk.x; cx++) {
+        ivec3 base = ivec3(cx, cy, cz) * S;
+        WorldChunk* c = chunkOf(base);
+        if(!c)
             continue;
-        BlockModel* model = Registry::blocks.items[blocks[i]]->model;
-        if(!model)
+        ivec3 lo = glm::max(from - base, ivec3(0));
+        ivec3 hi = glm::min(to - base, ivec3(S-1));
+        for(i32 y=lo.y; y<=hi.y; y++) for(i32 z=lo.z; z<=hi.z; z++) {
+            const Chunk::blockID* row = in + (base.x+lo.x-from.x) + ((base.z+z-from.z) + (base.y+y-from.y)*size.z)*size.x;
+            for(i32 x=lo.x; x<=hi.x; x++)
+                c->chunk.setBlock(Chunk::indexOf({x, y, z}), row[x-lo.x]);
+        }
+        c->chunk.compact();
+        markChanged(c, lo, hi);
+    }
+    updateColumns(from, to);
+}
+
+void BlockAccessor::fillRegion(ivec3 from, ivec3 to, Chunk::blockID block) {
+    ivec3 fromChunk = from >> (i32)Chunk::SIZE_LOG2;
+    ivec3 toChunk = to >> (i32)Chunk::SIZE_LOG2;
+    for(i32 cy=fromChunk.y; cy<=toChunk.y; cy++)
+    for(i32 cz=fromChunk.z; cz<=toChunk.z; cz++)
+    for(i32 cx=fromChunk.x; cx<=toChunk.x; cx++) {
+        ivec3 base = ivec3(cx, cy, cz) * S;
+        WorldChunk* c = chunkOf(base);
+        if(!c)
             continue;
-        model->addToMesh(di);
+        ivec3 lo = glm::max(from - base, ivec3(0));
+        ivec3 hi = glm::min(to - base, ivec3(S-1));
+        if(lo == ivec3(0) && hi == ivec3(S-1))
+            c->chunk.fill(block);
+        else {
+            for(i32 y=lo.y; y<=hi.y; y++) for(i32 z=lo.z; z<=hi.z; z++) for(i32 x=lo.x; x<=hi.x; x++)
+                c->chunk.setBlock(Chunk::indexOf({x, y, z}), block);
+            c->chunk.compact();
+        }
+        markChanged(c, lo, hi);
+    }
+    updateColumns(from, to);
+}
+
+void ChunkCompactor::update(const ChunkGrid& chunks, ivec3 center, f32 time) {
+    u32 count = std::min(chunksPerUpdate, chunks.size());
+    for(u32 i=0; i<count; i++, cursor++) {
+        if(cursor >= chunks.size())
+            cursor = 0;
+        WorldChunk* wc = chunks.loaded[cursor];
+        // the generation jobs write into the chunks that have no terrain yet
+        if(wc->stage < STAGE_TERRAIN || wc->loading)
+            continue;
+        bool packed = wc->chunk.isPacked();
+        // changed or unpacked since the last visit
+        if(wc->chunk.revision != wc->idleRevision || (wc->compacted && !packed)) {
+            wc->idleRevision = wc->chunk.revision;
+            wc->idleSince = time;
+            wc->compacted = false;
+            continue;
+        }
+        if(packed)
+            continue;
+        ivec3 d = glm::abs(wc->coords - center);
+        if(std::max(d.x, std::max(d.y, d.z)) > activeRadius || time - wc->idleSince >= idleTime)
+            wc->compacted = wc->chunk.pack();
+    }
+}
+
+ChunkCompactor::Stats ChunkCompactor::stats(const ChunkGrid& chunks) const {
+    Stats s;
+    for(const WorldChunk* wc : chunks) {
+        const Chunk& c = wc->chunk;
+        s.chunks++;
+        s.packedChunks += c.isPacked();
+        s.storedBytes += (c.blocks.data.capacity() + c.lightlevels.data.capacity())*sizeof(u64) + c.blocks.packed.capacity() + c.lightlevels.packed.capacity();
+        s.unpackedBytes += c.blocks.unpackedSize() + c.lightlevels.unpackedSize();
+    }
+    return s;
+}
 
+const char* chunkStageNames[STAGE_COUNT] = {
+    "empty", "terrain", "features", "lit", "meshed", "uploaded"
+};
+
+static f64 secondsNow() {
+    return std::chrono::duration<f64>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ChunkFocus::update(vec3 pos, vec3 vel, vec3 lookingAt) {
+    position = pos / (f32)Chunk::CHUNKSIZE;
+    predicted = (pos + vel*lookahead) / (f32)Chunk::CHUNKSIZE;
+    // the same direction as Camera::makeMatrices
+    view = vec3(std::cos(lookingAt.x)*std::cos(lookingAt.y), std::sin(lookingAt.y), std::sin(lookingAt.x)*std::cos(lookingAt.y));
+}
+
+void ChunkPipeline::add(World& world, WorldChunk* wc) {
+    wc->stage = STAGE_EMPTY;
+    wc->cost = world.focus.cost(wc->coords);
+    wc->requestedAt = secondsNow();
+    stageCounts[STAGE_EMPTY]++;
+    if(world.storage.isOpen()) {
+        loading++;
+        wc->loading = true;
+        // looked up again when it is decoded, a mapping can move until then
+        u32 size;
+        if(world.storage.mappedChunk(wc->coords, size))
+            mapped.push_back(wc);
+        else
+            load(world, wc);
+        return;
+    }
+    generating++;
+    world.generation.submit(wc, wc->cost);
+}
+
+AsyncIO::Task ChunkPipeline::load(World& world, WorldChunk* wc) {
+    AsyncIO::Request request = co_await world.storage.loadChunk(wc->coords);
+    world.storage.bytesRead += request.bytes.size();
+    loaded.push_back({ wc, std::move(request.bytes) });
+}
+
+// saved chunks were lit when they were written, the others are generated
+bool ChunkPipeline::finishLoad(World& world, WorldChunk* wc, const u8* data, u64 size) {
+    loading--;
+    wc->loading = false;
+    if(size == 0 || !wc->chunk.deserialize(data, size, world.loadStates.empty() ? nullptr : &world.loadStates)) {
+        generating++;
+        world.generation.submit(wc, wc->cost);
+        return false;
+    }
+    stageCounts[wc->stage]--;
+    wc->stage = STAGE_LIT;
+    stageCounts[STAGE_LIT]++;
+    applyPendingWrites(world, wc);
+    wc->savedRevision = wc->chunk.revision;
+    return true;
+}
+
+// keeps the highest row of every chunk column that a feature wrote into
+static void noteWrittenRow(std::unordered_map<ivec2, i32>& writtenRows, ivec3 blockPos) {
+    ivec3 coords = blockPos >> (i32)Chunk::SIZE_LOG2;
+    auto [row, added] = writtenRows.try_emplace(ivec2(coords.x, coords.z), coords.y);
+    if(!added)
+        row->second = std::max(row->second, coords.y);
+}
+
+// the features of the neighbours that reached into the chunk before it was there
+void ChunkPipeline::applyPendingWrites(World& world, WorldChunk* wc) {
+    auto pending = pendingWrites.find(wc->coords);
+    if(pending == pendingWrites.end())
+        return;
+    BlockAccessor accessor(world.chunks, wc->coords * (i32)Chunk::CHUNKSIZE, &world.generator.columns);
+    std::unordered_map<ivec2, i32> writtenRows;
+    for(const FeatureWrite& write : pending->second)
+        if(accessor.get(write.pos) == 0) {
+            accessor.set(write.pos, write.block);
+            noteWrittenRow(writtenRows, write.pos);
+        }
+    pendingWrites.erase(pending);
+    relightColumns(world, writtenRows);
+}
+
+void ChunkPipeline::remove(WorldChunk* wc) {
+    stageCounts[wc->stage]--;
+}
+
+bool ChunkPipeline::cancel(World& world, WorldChunk* wc) {
+    if(wc->stage != STAGE_EMPTY || wc->loading || !world.generation.cancel(wc))
+        return false;
+    generating--;
+    return true;
+}
+
+bool ChunkPipeline::neighboursReached(const World& world, const WorldChunk* wc, ChunkStage stage, bool diagonals) const {
+    if(!diagonals) {
+        for(u32 dir=0; dir<DIRECTION_COUNT; dir++)
+            if(wc->neighbours[dir] && wc->neighbours[dir]->stage < stage)
+                return false;
+        return true;
+    }
+    for(i32 dy=-1; dy<=1; dy++) for(i32 dz=-1; dz<=1; dz++) for(i32 dx=-1; dx<=1; dx++) {
+        const WorldChunk* n = world.chunks.get(wc->coords + ivec3(dx, dy, dz));
+        if(n && n->stage < stage)
+            return false;
+    }
+    return true;
+}
+
+void ChunkPipeline::placeFeatures(World& world, WorldChunk* wc) {
+    vector<FeatureWrite> writes;
+    world.generator.features(wc->coords, writes);
+    ivec2 rows = World::verticalChunks();
+    BlockAccessor accessor(world.chunks, wc->coords * (i32)Chunk::CHUNKSIZE, &world.generator.columns);
+    std::unordered_map<ivec2, i32> writtenRows;
+    for(const FeatureWrite& write : writes) {
+        if(!accessor.chunkOf(write.pos)) {
+            // rows above or below the world never load, the blocks there are cut off
+            ivec3 coords = write.pos >> (i32)Chunk::SIZE_LOG2;
+            if(coords.y >= rows.x && coords.y < rows.y)
+                pendingWrites[coords].push_back(write);
+        }
+        else if(accessor.get(write.pos) == 0) {
+            accessor.set(write.pos, write.block);
+            noteWrittenRow(writtenRows, write.pos);
+        }
+    }
+    relightColumns(world, writtenRows);
+}
+
+// the writes raised the top solid blocks of the columns, which darkens the lit chunks under them
+// the sky light is only seeded, so seeding again gives the same light as if the blocks had been there
+void ChunkPipeline::relightColumns(World& world, const std::unordered_map<ivec2, i32>& writtenRows) {
+    ivec2 rows = World::verticalChunks();
+    for(const auto& [column, top] : writtenRows)
+    for(i32 y=std::min(top, rows.y-1); y>=rows.x; y--) {
+        WorldChunk* c = world.chunks.get(ivec3(column.x, y, column.y));
+        if(!c || c->stage < STAGE_LIT || c->loading)
+            continue;
+        seedSunlight(world, c);
+        // so that the new light is saved
+        c->chunk.revision++;
+        c->needsRemeshing = true;
+        for(u32 dir=0; dir<DIRECTION_COUNT; dir++)
+            if(c->neighbours[dir])
+                c->neighbours[dir]->needsRemeshing = true;
+    }
+}
+
+// blocks above the top solid block of their column get full sky light
+void ChunkPipeline::seedSunlight(World& world, WorldChunk* wc) {
+    constexpr i32 S = Chunk::CHUNKSIZE;
+    const ChunkColumn& column = *world.generator.column({wc->coords.x, wc->coords.z});
+    i32 bottom = wc->coords.y*S;
+    i32 lowestTop = column.topSolid[0], highestTop = column.topSolid[0];
+    for(i32 i=1; i<S*S; i++) {
+        lowestTop = std::min(lowestTop, column.topSolid[i]);
+        highestTop = std::max(highestTop, column.topSolid[i]);
+    }
+    if(bottom > highestTop) {
+        wc->chunk.lightlevels.fill(15);
+        return;
+    }
+    wc->chunk.lightlevels.fill(0);
+    if(bottom + S-1 <= lowestTop)
+        return;
+    Chunk::Layout::forEach([&](ivec3 p, u32 i) {
+        if(bottom + p.y > column.topSolid[p.x + p.z*S])
+            wc->chunk.lightlevels.set(i, 15);
+    });
+    wc->chunk.lightlevels.repack();
+}
+
+// runs on the jobs, the neighbours are looked up in the directory instead of following the links of the grid
+// a neighbour that is not lit yet may still be generating, it counts as missing and this chunk is remeshed once it is
+void ChunkPipeline::mesh(World& world, WorldChunk* wc) {
+    ChunkDirectory& directory = world.chunks.directory;
+    Epochs::Guard guard(directory.epochs);
+    Chunk* neighbours[DIRECTION_COUNT];
+    wc->missingNeighbours = 0;
+    for(u32 dir=0; dir<DIRECTION_COUNT; dir++) {
+        WorldChunk* n = directory.find(guard, wc->coords + directionVector[dir]);
+        neighbours[dir] = n && n->stage >= STAGE_LIT && !n->loading ? &n->chunk : nullptr;
+        if(!neighbours[dir])
+            wc->missingNeighbours |= 1 << dir;
+    }
+    wc->chunk.makeVoxelMesh(wc->mesh, neighbours);
+    wc->needsRemeshing = false;
+}
+
+bool ChunkPipeline::update(World& world, bool unlimited) {
+    const ChunkFocus& focus = world.focus;
+    metrics.queued = world.generation.rescore([&](WorldChunk* wc) { return focus.cost(wc->coords); });
+    vector<WorldChunk*> generated;
+    world.generation.collect(generated);
+    for(WorldChunk* wc : generated) {
+        generating--;
+        stageCounts[wc->stage]--;
+        wc->stage = STAGE_TERRAIN;
+        stageCounts[STAGE_TERRAIN]++;
+        applyPendingWrites(world, wc);
+    }
+    // the mapped chunks are decoded from the page cache without a copy, the reads go first so
+    // a chunk whose mapping went away or whose pages left the page cache is read on the jobs instead
+    for(WorldChunk* wc : mapped) {
+        u32 size = 0;
+        const u8* data = world.storage.mappedChunk(wc->coords, size);
+        if(!data) {
+            load(world, wc);
+            continue;
+        }
+        world.storage.bytesRead += size;
+        finishLoad(world, wc, data, size);
+    }
+    mapped.clear();
+    for(auto& [wc, bytes] : loaded)
+        finishLoad(world, wc, bytes.data(), bytes.size());
+    loaded.clear();
+
+    u32 done[STAGE_COUNT] = {};
+    // without a way to upload the meshes the chunks stop once they are meshed
+    ChunkStage last = upload ? target : std::min(target, STAGE_MESHED);
+    auto allowed = [&](ChunkStage next) { return next <= last && (unlimited || budget[next] == 0 || done[next] < budget[next]); };
+    std::chrono::steady_clock::time_point start;
+    auto startTimer = [&]() { start = std::chrono::steady_clock::now(); };
+    auto stopTimer = [&](ChunkStage stage) { stageSeconds[stage] += std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count(); };
+    auto advance = [&](WorldChunk* wc, ChunkStage next, bool counted = false) {
+        stageCounts[wc->stage]--;
+        wc->stage = next;
+        stageCounts[next]++;
+        if(!counted)
+            done[next]++;
+        if(next == last) {
+            f64 seconds = secondsNow() - wc->requestedAt;
+            metrics.totalTimeToVisible += seconds;
+            metrics.maxTimeToVisible = std::max(metrics.maxTimeToVisible, seconds);
+            metrics.recentTimeToVisible = metrics.visible == 0 ? seconds : metrics.recentTimeToVisible*0.95 + seconds*0.05;
+            metrics.visible++;
+        }
     };
+    // the budgets go to the cheapest chunks first
+    vector<WorldChunk*> order(world.chunks.begin(), world.chunks.end());
+    for(WorldChunk* wc : order)
+        wc->cost = focus.cost(wc->coords);
+    std::sort(order.begin(), order.end(), [](const WorldChunk* a, const WorldChunk* b) { return a->cost < b->cost; });
+    vector<WorldChunk*> meshing;
+    // every stage is tried in one pass so a chunk can go through several stages in one update
+    for(WorldChunk* wc : order) {
+        if(wc->stage == STAGE_TERRAIN && allowed(STAGE_FEATURES)) {
+            startTimer();
+            placeFeatures(world, wc);
+            stopTimer(STAGE_FEATURES);
+            advance(wc, STAGE_FEATURES);
+        }
+        if(wc->stage == STAGE_FEATURES && allowed(STAGE_LIT) && neighboursReached(world, wc, STAGE_FEATURES, true)) {
+            startTimer();
+            seedSunlight(world, wc);
+            stopTimer(STAGE_LIT);
+            advance(wc, STAGE_LIT);
+        }
+        // the meshes are made together after the pass, done counts them as they are picked
+        if(wc->stage == STAGE_LIT && allowed(STAGE_MESHED) && neighboursReached(world, wc, STAGE_LIT, false)) {
+            meshing.push_back(wc);
+            done[STAGE_MESHED]++;
+        }
+        else if(wc->stage == STAGE_MESHED && allowed(STAGE_UPLOADED)) {
+            startTimer();
+            upload(wc->mesh);
+            stopTimer(STAGE_UPLOADED);
+            advance(wc, STAGE_UPLOADED);
+        }
+        else if(wc->stage == STAGE_UPLOADED && wc->needsRemeshing && allowed(STAGE_MESHED)) {
+            meshing.push_back(wc);
+            done[STAGE_MESHED]++;
+        }
+    }
+    if(meshing.empty())
+        return generating == 0 && loading == 0 && stageCounts[last] == world.chunks.size();
+
+    // the mesher reads every voxel, so the packed chunks are unpacked once here instead of decoded on every read
+    for(WorldChunk* wc : meshing) {
+        wc->chunk.unpack();
+        for(u32 dir=0; dir<DIRECTION_COUNT; dir++) {
+            WorldChunk* n = wc->neighbours[dir];
+            // the same neighbours mesh skips, the generation threads may be writing them
+            if(n && n->stage >= STAGE_LIT && !n->loading)
+                n->chunk.unpack();
+        }
+    }
+    startTimer();
+    Jobs::parallelFor("mesh", meshing.size(), 1, [&](u32 i) { mesh(world, meshing[i]); });
+    stopTimer(STAGE_MESHED);
+    for(WorldChunk* wc : meshing) {
+        if(wc->stage == STAGE_UPLOADED) {
+            startTimer();
+            upload(wc->mesh);
+            stopTimer(STAGE_MESHED);
+            continue;
+        }
+        advance(wc, STAGE_MESHED, true);
+        // the neighbours that were meshed without this chunk drew the faces towards it
+        for(u32 dir=0; dir<DIRECTION_COUNT; dir++) {
+            WorldChunk* n = wc->neighbours[dir];
+            if(n && n->stage >= STAGE_MESHED && (n->missingNeighbours & (1 << directionOpposite[dir])))
+                n->needsRemeshing = true;
+        }
+        if(allowed(STAGE_UPLOADED)) {
+            startTimer();
+            upload(wc->mesh);
+            stopTimer(STAGE_UPLOADED);
+            advance(wc, STAGE_UPLOADED);
+        }
+    }
+    return generating == 0 && loading == 0 && stageCounts[last] == world.chunks.size();
+}
+
+const char* loadLevelNames[LEVEL_COUNT] = {
+    "entity ticking", "ticking", "render", "unloaded"
+};
+
+u32 ChunkTickets::add(const ChunkTicket& ticket) {
+    tickets[nextID] = ticket;
+    return nextID++;
+}
+
+ChunkTicket* ChunkTickets::get(u32 id) {
+    auto it = tickets.find(id);
+    return it == tickets.end() ? nullptr : &it->second;
+}
+
+void ChunkTickets::remove(u32 id) {
+    tickets.erase(id);
+}
+
+LoadLevel ChunkTickets::levelOf(ivec2 column) const {
+    LoadLevel level = LEVEL_UNLOADED;
+    for(const auto& p : tickets) {
+        ivec2 d = column - p.second.column;
+        if(d.x*d.x + d.y*d.y <= p.second.radius*p.second.radius)
+            level = std::min(level, p.second.level);
+    }
+    return level;
+}
+
+bool ChunkTickets::keeps(ivec2 column, i32 margin) const {
+    for(const auto& p : tickets) {
+        ivec2 d = column - p.second.column;
+        i32 radius = p.second.radius + margin;
+        if(d.x*d.x + d.y*d.y <= radius*radius)
+            return true;
+    }
+    return false;
+}
+
+void ChunkStreamer::followCenter(World& world) {
+    ivec2 center = { world.centerChunk.x, world.centerChunk.z };
+    // the prefetched columns stay within the unload radius
+    vec2 ahead = glm::floor(vec2(world.focus.predicted.x, world.focus.predicted.z)) - vec2(center);
+    f32 maxAhead = (f32)(unloadRadius - loadRadius);
+    if(glm::length(ahead) > maxAhead)
+        ahead *= maxAhead / glm::length(ahead);
+    ivec2 prefetchCenter = center + ivec2((i32)std::round(ahead.x), (i32)std::round(ahead.y));
+    // the saved chunks of both load tickets are read ahead into the page cache when the columns move,
+    // unloadRadius around the prefetch center covers the view ticket as well
+    if(world.storage.isOpen() && (prefetchTicket == 0 || prefetchCenter != prefetched)) {
+        world.storage.prefetch(prefetchCenter, unloadRadius);
+        prefetched = prefetchCenter;
+    }
+    auto place = [&](u32& id, ivec2 column, i32 radius, LoadLevel level) {
+        ChunkTicket* ticket = id ? world.tickets.get(id) : nullptr;
+        if(ticket)
+            *ticket = { column, radius, level };
+        else
+            id = world.tickets.add({ column, radius, level });
+    };
+    place(viewTicket, center, loadRadius, LEVEL_RENDER);
+    place(simulationTicket, center, simulationRadius, LEVEL_ENTITY_TICKING);
+    place(prefetchTicket, prefetchCenter, loadRadius, LEVEL_RENDER);
+}
+
+void ChunkStreamer::update(World& world, bool unlimited) {
+    ivec2 rows = World::verticalChunks();
+    // the chunks unloaded before go back to the pool once no other thread reads them
+    stats.reclaimed += world.chunks.collect();
+    followCenter(world);
+    const ChunkTickets& tickets = world.tickets;
+    i32 margin = unloadRadius - loadRadius;
+
+    vector<WorldChunk*> far;
+    for(u32 level=0; level<LEVEL_COUNT; level++)
+        stats.levels[level] = 0;
+    for(WorldChunk* wc : world.chunks) {
+        ivec2 column = { wc->coords.x, wc->coords.z };
+        wc->level = tickets.levelOf(column);
+        if(wc->level == LEVEL_UNLOADED) {
+            if(tickets.keeps(column, margin))
+                wc->level = LEVEL_RENDER;
+            else
+                far.push_back(wc);
+        }
+        stats.levels[wc->level]++;
+    }
+    u32 unloads = 0;
+    for(WorldChunk* wc : far) {
+        if(!unlimited && unloads >= unloadsPerUpdate)
+            break;
+        unloads += unload(world, wc);
+    }
+    // the features that reached into columns that went away with their own column
+    if(unloads > 0) {
+        for(auto it = world.pipeline.pendingWrites.begin(); it != world.pipeline.pendingWrites.end(); ) {
+            if(!tickets.keeps({it->first.x, it->first.z}, margin+1))
+                it = world.pipeline.pendingWrites.erase(it);
+            else ++it;
+        }
+    }
+
+    auto complete = [&](ivec2 column) {
+        for(i32 y=rows.x; y<rows.y; y++)
+            if(!world.chunks.has({column.x, y, column.y}))
+                return false;
+        return true;
+    };
+    vector<ivec2> missing;
+    for(const auto& p : tickets.tickets) {
+        const ChunkTicket& ticket = p.second;
+        for(i32 x=-ticket.radius; x<=ticket.radius; x++) for(i32 z=-ticket.radius; z<=ticket.radius; z++)
+            if(x*x + z*z <= ticket.radius*ticket.radius && !complete(ticket.column + ivec2(x, z)))
+                missing.push_back(ticket.column + ivec2(x, z));
+    }
+    i32 focusRow = std::clamp(world.centerChunk.y, rows.x, rows.y-1);
+    auto columnCost = [&](ivec2 column) { return world.focus.cost({column.x, focusRow, column.y}); };
+    std::stable_sort(missing.begin(), missing.end(), [&](ivec2 a, ivec2 b) { return columnCost(a) < columnCost(b); });
+
+    u32 loads = 0;
+    for(ivec2 column : missing) {
+        for(i32 y=rows.x; y<rows.y && (unlimited || loads < loadsPerUpdate); y++) {
+            ivec3 coords = { column.x, y, column.y };
+            if(world.chunks.has(coords))
+                continue;
+            WorldChunk* wc = world.pool.acquire(coords);
+            wc->level = tickets.levelOf(column);
+            world.chunks.insert(wc);
+            world.pipeline.add(world, wc);
+            loads++;
+            stats.loaded++;
+        }
+        if(!unlimited && loads >= loadsPerUpdate)
+            break;
+    }
+
+    // the entities come back once there is terrain under them
+    for(auto it = parked.begin(); it != parked.end(); ) {
+        WorldChunk* wc = world.chunks.get(it->first);
+        if(!wc || wc->stage < STAGE_FEATURES) {
+            ++it;
+            continue;
+        }
+        for(Entity* entity : it->second)
+            wc->entities[entity->uuid] = entity;
+        stats.parkedEntities -= it->second.size();
+        it = parked.erase(it);
+    }
+}
+
+bool ChunkStreamer::unload(World& world, WorldChunk* wc) {
+    ivec2 rows = World::verticalChunks();
+    // the player is never parked, it goes to a chunk of the center column
+    auto playerIt = world.player ? wc->entities.find(world.player->uuid) : wc->entities.end();
+    if(playerIt != wc->entities.end()) {
+        ivec3 home = world.centerChunk;
+        home.y = std::clamp(home.y, rows.x, rows.y-1);
+        WorldChunk* target = world.chunks.get(home);
+        if(!target || target == wc)
+            return false;
+        target->entities[world.player->uuid] = world.player;
+        wc->entities.erase(playerIt);
+    }
+    // a chunk a worker is generating goes in a later update
+    if(wc->stage == STAGE_EMPTY && !world.pipeline.cancel(world, wc))
+        return false;
+    // entities that fell out of or flew above the world wait in the nearest row that loads
+    for(auto& entityp : wc->entities) {
+        ivec3 coords = World::chunkCoords(entityp.second->pos);
+        coords.y = std::clamp(coords.y, rows.x, rows.y-1);
+        parked[coords].push_back(entityp.second);
+        stats.parkedEntities++;
+    }
+    wc->entities.clear();
+    // the faces towards this chunk were hidden
+    for(u32 dir=0; dir<DIRECTION_COUNT; dir++)
+        if(wc->neighbours[dir])
+            wc->neighbours[dir]->needsRemeshing = true;
+    ivec3 coords = wc->coords;
+    if(world.storage.isOpen())
+        world.saveChunk(wc);
+    world.pipeline.remove(wc);
+    world.chunks.release(world.chunks.remove(coords), world.pool);
+    stats.unloaded++;
+    // the cached column goes with the last chunk of the column
+    for(i32 y=rows.x; y<rows.y; y++)
+        if(world.chunks.has({coords.x, y, coords.z}))
+            return true;
+    world.generator.columns.evict({coords.x, coords.z});
+    // and the climate region with the last column of the region
+    ivec2 region = ClimateRegion::regionOf({coords.x, coords.z});
+    for(i32 z=0; z<ClimateRegion::COLUMNS; z++) for(i32 x=0; x<ClimateRegion::COLUMNS; x++)
+        for(i32 y=rows.x; y<rows.y; y++)
+            if(world.chunks.has({region.x*ClimateRegion::COLUMNS + x, y, region.y*ClimateRegion::COLUMNS + z}))
+                return true;
+    world.generator.climate.evict(region);
+    return true;
 }
 
 void World::updateRenderChunks() {
+    streamer.update(*this);
+}
 
+void World::saveChunk(WorldChunk* wc) {
+    // a chunk whose last save failed is written again even when it did not change since
+    if(wc->stage < STAGE_LIT || (wc->chunk.revision == wc->savedRevision && !storage.unsaved(wc->coords)))
+        return;
+    vector<u8> bytes;
+    wc->chunk.serialize(bytes, saveStates.empty() ? nullptr : &saveStates);
+    storage.saveChunk(wc->coords, std::move(bytes), wc->chunk.isPacked() ? COMPRESSION_PACKED : COMPRESSION_NONE);
+    wc->savedRevision = wc->chunk.revision;
+}
+
+bool World::mapStates(vector<string>& states) {
+    vector<string> names = Registry::blockStateNames();
+    loadStates.clear();
+    saveStates.clear();
+    if(states == names)
+        return false;
+    std::unordered_map<string, u16> saved;
+    for(u32 i=0; i<states.size(); i++)
+        saved[states[i]] = i;
+    bool changed = false;
+    saveStates.resize(names.size());
+    for(u32 state=0; state<names.size(); state++) {
+        auto it = saved.find(names[state]);
+        if(it == saved.end()) {
+            it = saved.insert({ names[state], (u16)states.size() }).first;
+            states.push_back(names[state]);
+            changed = true;
+        }
+        saveStates[state] = it->second;
+    }
+    loadStates.resize(states.size());
+    for(u32 i=0; i<states.size(); i++) {
+        auto it = Registry::blocks.names.find(states[i]);
+        if(it == Registry::blocks.names.end() && !states[i].empty())
+            Log::warning("The saved block state ", states[i], " is not registered, it loads as air");
+        loadStates[i] = it == Registry::blocks.names.end() ? 0 : it->second;
+    }
+    return changed;
 }
 
 void World::init() {
-    i32 rd = 5;
-    ivec3 start = {-rd, 0, -rd};
-    ivec3 end = { rd, 1, rd};
-
-    for(i32 x=start.x; x<end.x; x++) for(i32 z=start.z; z<end.z; z++) for(i32 y=start.y; y<end.y; y++) {
-        ivec3 p = {x, y, z};
-        
-        WorldChunk* wc = new WorldChunk(p);
-        //wc->chunk.makeRandom();
-        wc->chunk.makeSin(p);
-        wc->mesh.chunkCoords = p;
-        chunks[p] = wc;
-        
+    // a saved world keeps its seed, the chunks on disk were made with it
+    vector<string> states;
+    bool saved = storage.isOpen() && storage.hasInfo();
+    if(saved && !storage.readInfo(seed, states)) {
+        // writing a new seed over it would break every saved chunk, the folder is left alone
+        Log::error("The world in ", storage.folder, " cannot be loaded, this world stays in memory");
+        storage.close();
+        storage.folder.clear();
+    }
+    // the chunks of worlds saved without the names were saved with the ids of this registry
+    if(states.empty())
+        states = Registry::blockStateNames();
+    if(storage.isOpen() && (mapStates(states) || !saved) && !storage.writeInfo(seed, states))
+        Log::warning("Cannot write the world info into ", storage.folder);
+    generator.init(seed);
+    generation.start(generator);
+    // the load radius around the spawn is filled before the first frame
+    ivec3 spawn = { 21, 0, 21 };
+    centerChunk = { spawn.x >> (i32)Chunk::SIZE_LOG2, verticalChunks().x, spawn.z >> (i32)Chunk::SIZE_LOG2 };
+    chunks.recenter(centerChunk);
+    focus.update(vec3(spawn), vec3(0), vec3(0));
+    // the spawn anchor keeps the chunks around the spawn loaded and ticking
+    tickets.add({ { centerChunk.x, centerChunk.z }, 1, LEVEL_TICKING });
+    streamer.update(*this, true);
+    // the saved chunks come from the disk, the others from the generation jobs
+    while(!pipeline.update(*this, true)) {
+        AsyncIO::update();
+        if(!Jobs::help())
+            std::this_thread::yield();
+    }
+
+    for(WorldChunk* wc : chunks) {
+        ivec3 p = wc->coords;
         UUID cown = UUID_make();
         Entity* cow = new Entity();
         cow->uuid = cown;
@@ -131,95 +1594,47 @@ void World::init() {
         wc->entities[cown] = cow;
     }
 
-    for(i32 x=start.x; x<end.x; x++) for(i32 z=start.z; z<end.z; z++) for(i32 y=start.y; y<end.y; y++) {
-        ivec3 p = {x, y, z};
-        WorldChunk* wc = chunks[p];
-        Chunk* neighbours[6];
-        for(u32 dir=0; dir < 6; dir++) {
-            ivec3 np = p + directionVector[dir];
-            if(chunks.find(np) != chunks.end())
-                neighbours[dir] = &chunks[np]->chunk;
-            else
-                neighbours[dir] = nullptr;
-        }
-        wc->chunk.makeVoxelMesh(wc->mesh, neighbours);
-        wc->mesh.makeObjects();
-    }
+    u64 chunkMemory = 0;
+    for(WorldChunk* wc : chunks)
+        chunkMemory += wc->chunk.memoryUsage();
+    Log::info("World chunks use ", chunkMemory/1024, " KB for ", chunks.size(), " chunks");
+    Log::info("Chunk pool: ", pool.stats.used, "/", pool.stats.capacity, " slots in ", pool.stats.slabs, " slabs, ", pool.stats.reservedBytes/1024, " KB reserved");
 
     player = new Entity();
     player->type = Registry::entities.names.at("player");
     player->uuid = UUID_make();
-    player->pos = { 21.0f, 26.0f, 21.0f };
+    // standing on the highest block of the spawn column
+    spawn.y = generator.column({spawn.x >> (i32)Chunk::SIZE_LOG2, spawn.z >> (i32)Chunk::SIZE_LOG2})->topSolid[ChunkColumn::indexOf(spawn)] + 1;
+    player->pos = vec3(spawn) + vec3(0.0f, -Registry::entities.items[player->type].aabb.start.y, 0.0f);
     player->lookingAt = { -3.141f*0.75f, 0, 0 };
     player->vel = {0,0,0};
     player->acc = {0,0,0};
-    chunks[chunkCoords(player->pos)]->entities[player->uuid] = player;
-
-}
-
-void World::draw(f32 time) const {
+    centerChunk = chunkCoords(player->pos);
+    chunks.recenter(centerChunk);
+    // above the loaded rows the player lives in the top chunk of its column
+    ivec3 home = centerChunk;
+    home.y = std::clamp(home.y, verticalChunks().x, verticalChunks().y-1);
+    chunks.get(home)->entities[player->uuid] = player;
 
-    camera.pos = player->pos + 1.75f;
-    camera.angles = player->lookingAt;
-    camera.makeMatrices();
-
-    shader::bind(Registry::shaders["voxel"]);
-    camera.setMatrices();
-    gl::bindTexture(Registry::glTextures["atlas"].glid, 0);
-    shader::setTexture("tex", 0);
-    for(auto& p : chunks) {
-        p.second->mesh.updateUniforms();
-        p.second->mesh.draw();
-    }
-
-    shader::bind(Registry::shaders["simple"]);
-    camera.setMatrices();
-    shader::setTexture("tex", 0);
-    for(auto& p : chunks) for(auto& pp : p.second->entities) {
-        u32 textureID = Registry::entities.items[pp.second->type].model->texture;
-        pp.second->updateMeshes(time);
-        gl::bindTexture(Registry::glTextures.items[textureID].glid, 0);
-        for(auto& mesh : pp.second->meshes) {
-            mesh.updateUniforms();
-            mesh.draw();
-        }
-    }
 }
 
 AABB playerBB = { {-0.4, -1.7, -0.4}, { 0.8, 1.95, 0.5 } };
 bool inspectMode = false;
 
 void World::update(f32 time, f32 dt) {
-    (void) time;
-
-    // adding forces
-    for(pair<const ivec3, WorldChunk*>& chunkp : chunks) 
-        for(pair<const UUID, Entity*>& entityp : chunkp.second->entities) {
+    // adding forces, only the entity ticking chunks simulate their entities
+    for(WorldChunk* wc : chunks) 
+        if(wc->level == LEVEL_ENTITY_TICKING)
+        for(pair<const UUID, Entity*>& entityp : wc->entities) {
             entityp.second->acc = {0,0,0};
             entityp.second->acc += vec3(0,-9.8,0);
         }
 
-    static constexpr float cameraAngleSpeed = 2.0f;
     static constexpr float cameraSpeed = 8.0f;
     static constexpr float stoptime = 0.2f;
     
-    vec3 movement = {0, 0, 0};
-    if(Input::isPressed(GLFW_KEY_W))
-        movement += vec3(0, 0, 1);
-    if(Input::isPressed(GLFW_KEY_A))
-        movement += vec3(-1, 0, 0);
-    if(Input::isPressed(GLFW_KEY_S))
-        movement += vec3(0, 0, -1);
-    if(Input::isPressed(GLFW_KEY_D))
-        movement += vec3(1, 0, 0);
-    if(Input::isPressed(GLFW_KEY_UP))
-        movement += vec3(0, 1, 0);
-    if(Input::isPressed(GLFW_KEY_DOWN))
-        movement += vec3(0, -1, 0);
-    bool escape = Input::isPressed(GLFW_KEY_ESCAPE);
-    if(Input::events["escape"].happened())
-        Input::toggleCursor();
-    if(Input::events["spectator_toggle"].happened())
+    vec3 movement = controls.movement;
+    if(controls.toggleInspect)
         inspectMode = !inspectMode;
     if(inspectMode)
         player->acc = {};
@@ -230,24 +1645,20 @@ void World::update(f32 time, f32 dt) {
             + movement.x * vec3(-std::sin(player->lookingAt.x), 0, std::cos(player->lookingAt.x));
     player->acc += movementReal * cameraSpeed;
 
-    if(Input::disabledCursor) {
-        vec2 mc = Input::mouseDiff;
-        mc.x /= window::width;
-        mc.y /= window::height;
-        player->lookingAt += vec3(mc.x, mc.y, 0) * cameraAngleSpeed;
-        constexpr float PI = 3.14159268f;
-        if(player->lookingAt.y > 0.5f*PI*0.99f)
-            player->lookingAt.y = 0.5f*PI*0.99f;
-        if(player->lookingAt.y < -0.5f*PI*0.99f)
-            player->lookingAt.y = -0.5f*PI*0.99f;
-        if(player->lookingAt.x > PI)
-            player->lookingAt.x -= 2.0*PI;
-        if(player->lookingAt.x < -PI)
-            player->lookingAt.x += 2.0*PI;
-    }
-
-    for(pair<const ivec3, WorldChunk*>& chunkp : chunks) 
-        for(pair<const UUID, Entity*>& entityp : chunkp.second->entities) {
+    player->lookingAt += vec3(controls.turn, 0);
+    constexpr float PI = 3.14159268f;
+    if(player->lookingAt.y > 0.5f*PI*0.99f)
+        player->lookingAt.y = 0.5f*PI*0.99f;
+    if(player->lookingAt.y < -0.5f*PI*0.99f)
+        player->lookingAt.y = -0.5f*PI*0.99f;
+    if(player->lookingAt.x > PI)
+        player->lookingAt.x -= 2.0*PI;
+    if(player->lookingAt.x < -PI)
+        player->lookingAt.x += 2.0*PI;
+
+    for(WorldChunk* wc : chunks) 
+        if(wc->level == LEVEL_ENTITY_TICKING)
+        for(pair<const UUID, Entity*>& entityp : wc->entities) {
             entityp.second->vel += entityp.second->acc*dt;
             vec3 newpos = entityp.second->pos + entityp.second->vel*dt;
             if(entityp.second == player && inspectMode) {
@@ -259,18 +1670,35 @@ void World::update(f32 time, f32 dt) {
             entityp.second->vel -= glm::dot(entityp.second->vel, result.second) * result.second;
         }
 
-    for(pair<const ivec3, WorldChunk*>& chunkp : chunks) {
-        WorldChunk& chunk = *(chunkp.second);
+    for(WorldChunk* wc : chunks) {
+        WorldChunk& chunk = *wc;
         for(std::unordered_map<UUID, Entity*>::iterator it = chunk.entities.begin(); it != chunk.entities.end(); ) {
             Entity* entity = it->second;
             ivec3 chunkCoord = chunkCoords(entity->pos);
-            if(chunk.coords != chunkCoord && chunks.find(chunkCoord) != chunks.end()) {
+            WorldChunk* target = chunk.coords == chunkCoord ? nullptr : chunks.get(chunkCoord);
+            if(target && target->ready()) {
+                chunk.entities.erase(it++);
+                target->entities[entity->uuid] = entity;
+            }
+            // waits with the parked entities until the terrain is there, the player stays where it is
+            else if(target && entity != player) {
                 chunk.entities.erase(it++);
-                chunks[chunkCoord]->entities[entity->uuid] = entity;
+                streamer.parked[chunkCoord].push_back(entity);
+                streamer.stats.parkedEntities++;
             }
             else ++it;
         }
     }
+
+    ivec3 playerChunk = chunkCoords(player->pos);
+    if(playerChunk != centerChunk) {
+        centerChunk = playerChunk;
+        chunks.recenter(centerChunk);
+    }
+    focus.update(player->pos, player->vel, player->lookingAt);
+    updateRenderChunks();
+    pipeline.update(*this);
+    compactor.update(chunks, centerChunk, time);
     
 }
 
@@ -291,25 +1719,115 @@ inline ivec3 World::inChunkCoordsI(vec3 coords) {
 }
 
 pair<vec3, vec3> World::collide(const AABB& aabb, vec3 oldpos, vec3 newpos) const {
-    vec3 normal = {0,0,0};
-    for(u32 i=0; i<8; i++) {
-        vec3 dx = newpos + aabb.start;
-        dx += vec3((i&1)*aabb.size.x, ((i&2)>>1)*aabb.size.y, ((i&4)>>2)*aabb.size.z);
-        ivec3 dxi = ivec3(glm::floor(dx));
-        ivec3 chunkCoord = chunkCoords(dxi);
-        ivec3 blockCoords = inChunkCoordsI(dxi);
-        if(chunks.find(chunkCoord) == chunks.end())
-            continue;
-        Chunk::blockID block = chunks.at(chunkCoord)->chunk.blocks[Chunk::indexOf(blockCoords)];
-        if(block == 0)
-            continue;
+    ivec3 from = floor(newpos + aabb.start);
+    ivec3 to = floor(newpos + aabb.start + aabb.size);
+    if(regionPending(from, to) || regionOccupied(from, to))
         return {oldpos, {0, 1, 0}};
-    }
     return std::make_pair(newpos, vec3(0,0,0));
 }
 
-void World::destroy() {
+bool World::regionOccupied(ivec3 from, ivec3 to) const {
+    constexpr i32 S = Chunk::CHUNKSIZE;
+    ivec3 fromChunk = from >> (i32)Chunk::SIZE_LOG2;
+    ivec3 toChunk = to >> (i32)Chunk::SIZE_LOG2;
+    for(i32 cx=fromChunk.x; cx<=toChunk.x; cx++)
+    for(i32 cy=fromChunk.y; cy<=toChunk.y; cy++)
+    for(i32 cz=fromChunk.z; cz<=toChunk.z; cz++) {
+        WorldChunk* wc = chunks.get({cx, cy, cz});
+        if(!wc || !wc->ready() || wc->chunk.isEmpty())
+            continue;
+        ivec3 base = ivec3(cx, cy, cz) * S;
+        ivec3 lo = glm::max(from - base, ivec3(0));
+        ivec3 hi = glm::min(to - base, ivec3(S-1));
+        // only the voxels of the occupied bricks are looked at
+        for(i32 by=lo.y>>2; by<=hi.y>>2; by++)
+        for(i32 bz=lo.z>>2; bz<=hi.z>>2; bz++)
+        for(i32 bx=lo.x>>2; bx<=hi.x>>2; bx++) {
+            ivec3 brickStart = ivec3(bx, by, bz) * 4;
+            if(!wc->chunk.isBrickOccupied(Chunk::brickOf(brickStart)))
+                continue;
+            ivec3 blo = glm::max(lo, brickStart);
+            ivec3 bhi = glm::min(hi, brickStart + 3);
+            for(i32 y=blo.y; y<=bhi.y; y++) for(i32 z=blo.z; z<=bhi.z; z++) for(i32 x=blo.x; x<=bhi.x; x++)
+                if(wc->chunk.isOccupied({x, y, z}))
+                    return true;
+        }
+    }
+    return false;
+}
 
-    
+bool World::regionPending(ivec3 from, ivec3 to) const {
+    ivec3 fromChunk = from >> (i32)Chunk::SIZE_LOG2;
+    ivec3 toChunk = to >> (i32)Chunk::SIZE_LOG2;
+    for(i32 cx=fromChunk.x; cx<=toChunk.x; cx++)
+    for(i32 cy=fromChunk.y; cy<=toChunk.y; cy++)
+    for(i32 cz=fromChunk.z; cz<=toChunk.z; cz++) {
+        WorldChunk* wc = chunks.get({cx, cy, cz});
+        if(wc && !wc->ready())
+            return true;
+    }
+    return false;
+}
 
+World::RayHit World::raycast(vec3 origin, vec3 direction, f32 maxDistance) const {
+    constexpr i32 S = Chunk::CHUNKSIZE;
+    RayHit result = { false, {0,0,0}, {0,0,0}, maxDistance };
+    vec3 dir = glm::normalize(direction);
+    ivec3 normal = {0,0,0};
+    f32 t = 0;
+    while(t <= maxDistance) {
+        ivec3 block = floor(origin + dir*t);
+        ivec3 chunk = block >> (i32)Chunk::SIZE_LOG2;
+        ivec3 local = block & (S-1);
+        WorldChunk* wc = chunks.get(chunk);
+        // size of the empty cube around the current point
+        i32 cell = 1;
+        if(!wc || !wc->ready() || wc->chunk.isEmpty())
+            cell = S;
+        else if(!wc->chunk.isBrickOccupied(Chunk::brickOf(local)))
+            cell = 4;
+        else if(wc->chunk.isOccupied(local)) {
+            result = { true, block, normal, t };
+            return result;
+        }
+        ivec3 cellStart = block & ~(cell-1);
+        f32 exit = maxDistance + 1;
+        u32 axis = 0;
+        for(u32 a=0; a<3; a++) {
+            if(dir[a] == 0.0f)
+                continue;
+            f32 plane = dir[a] > 0 ? cellStart[a] + cell : cellStart[a];
+            f32 ta = (plane - origin[a]) / dir[a];
+            if(ta < exit) {
+                exit = ta;
+                axis = a;
+            }
+        }
+        normal = {0,0,0};
+        normal[axis] = dir[axis] > 0 ? -1 : 1;
+        t = std::max(exit, t) + 1e-4f;
+    }
+    return result;
+}
+
+void World::destroy() {
+    generation.stop();
+    // the chunks being read are released with the others, the changed ones are written before
+    if(storage.isOpen()) {
+        for(WorldChunk* wc : chunks)
+            saveChunk(wc);
+        storage.retryFailed();
+        AsyncIO::drain();
+        Log::info("World storage: ", storage.bytesRead/1024, " KB read, ", storage.bytesWritten/1024, " KB written");
+        storage.close();
+    }
+    generator.destroy();
+    ChunkCompactor::Stats packing = compactor.stats(chunks);
+    Log::info("Chunk streamer: ", streamer.stats.loaded, " chunks loaded, ", streamer.stats.unloaded, " unloaded, ", streamer.stats.reclaimed, " reclaimed, ", streamer.stats.parkedEntities, " entities parked");
+    Log::info("Load levels: ", streamer.stats.levels[LEVEL_ENTITY_TICKING], " entity ticking, ", streamer.stats.levels[LEVEL_TICKING], " ticking, ", streamer.stats.levels[LEVEL_RENDER], " render only");
+    Log::info("Chunk compactor: ", packing.packedChunks, "/", packing.chunks, " chunks packed, ", packing.storedBytes/1024, " KB stored for ", packing.unpackedBytes/1024, " KB of chunk data");
+    while(chunks.size() > 0)
+        chunks.release(chunks.remove(chunks.loaded.back()->coords), pool);
+    chunks.directory.epochs.drain();
+    pool.destroy();
 }
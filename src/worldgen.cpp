@@ -0,0 +1,295 @@
+#include "worldgen.hpp"
+#include "resources.hpp"
+#include "world.hpp"
+#include "jobs.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+void WorldGenerator::init(u64 worldSeed) {
+    seed = worldSeed;
+    palette.stone = Registry::blocks.names.at("stone");
+    palette.cobblestone = Registry::blocks.names.at("cobblestone");
+    palette.dirt = Registry::blocks.names.at("dirt");
+    palette.sand = Registry::blocks.names.at("sand");
+    palette.redSand = Registry::blocks.names.at("red_sand");
+    palette.grass = Registry::blocks.names.at("grass");
+    palette.logY = Registry::blocks.names.at("log/axis_y");
+    const BlockType& log = Registry::blockTypeOf(palette.logY);
+    i32 axis = log.propertyIndex("axis");
+    palette.logX = log.withProperty(palette.logY, axis, log.valueIndex(axis, "x"));
+    palette.logZ = log.withProperty(palette.logY, axis, log.valueIndex(axis, "z"));
+    noiseSeed = (u32)Random::mix(seed);
+    biomes[BIOME_PLAINS] = { "plains", palette.grass, palette.dirt, 1 };
+    biomes[BIOME_FOREST] = { "forest", palette.grass, palette.dirt, 6 };
+    biomes[BIOME_DESERT] = { "desert", palette.sand, palette.sand, 0 };
+    biomes[BIOME_BADLANDS] = { "badlands", palette.redSand, palette.redSand, 0 };
+    biomes[BIOME_ROCKY] = { "rocky", palette.stone, palette.stone, 0 };
+}
+
+Climate ClimateRegion::at(i32 x, i32 z) const {
+    x -= coords.x*BLOCKS;
+    z -= coords.y*BLOCKS;
+    i32 cx = x / STEP, cz = z / STEP;
+    f32 fx = (f32)(x - cx*STEP) / STEP, fz = (f32)(z - cz*STEP) / STEP;
+    const Climate& c00 = samples[cx + cz*(CELLS+1)];
+    const Climate& c10 = samples[cx+1 + cz*(CELLS+1)];
+    const Climate& c01 = samples[cx + (cz+1)*(CELLS+1)];
+    const Climate& c11 = samples[cx+1 + (cz+1)*(CELLS+1)];
+    auto lerp2 = [&](f32 Climate::* field) {
+        f32 top = c00.*field + (c10.*field - c00.*field)*fx;
+        f32 bottom = c01.*field + (c11.*field - c01.*field)*fx;
+        return top + (bottom - top)*fz;
+    };
+    return { lerp2(&Climate::temperature), lerp2(&Climate::humidity), lerp2(&Climate::erosion) };
+}
+
+ClimateRegion* WorldGenerator::climateRegion(ivec2 coords) {
+    ClimateRegion* region = climate.find(coords);
+    if(region)
+        return region;
+    constexpr i32 N = ClimateRegion::CELLS+1;
+    region = new ClimateRegion();
+    region->coords = coords;
+    f32 xs[N*N], zs[N*N], fields[3][N*N];
+    for(i32 z=0; z<N; z++) for(i32 x=0; x<N; x++) {
+        xs[x+z*N] = (f32)(coords.x*ClimateRegion::BLOCKS + x*ClimateRegion::STEP);
+        zs[x+z*N] = (f32)(coords.y*ClimateRegion::BLOCKS + z*ClimateRegion::STEP);
+    }
+    for(u32 f=0; f<3; f++)
+        Noise::fbm2(xs, zs, fields[f], N*N, noiseSeed + 0x100*(f+1), climateNoise);
+    // fbm rarely gets near 1, stretched so that the thresholds of the biomes are reached
+    for(i32 i=0; i<N*N; i++)
+        region->samples[i] = { 2.0f*fields[0][i], 2.0f*fields[1][i], 2.0f*fields[2][i] };
+    return climate.insert(region);
+}
+
+BiomeID WorldGenerator::biomeOf(const Climate& c) const {
+    if(c.erosion < -0.5f)
+        return BIOME_ROCKY;
+    if(c.temperature > 0.3f)
+        return c.humidity < -0.3f ? BIOME_BADLANDS : c.humidity < 0.1f ? BIOME_DESERT : BIOME_FOREST;
+    return c.humidity > 0.2f ? BIOME_FOREST : BIOME_PLAINS;
+}
+
+ChunkColumn* WorldGenerator::column(ivec2 coords) {
+    ChunkColumn* column = columns.find(coords);
+    if(column)
+        return column;
+    constexpr i32 S = ChunkColumn::S;
+    column = new ChunkColumn();
+    column->coords = coords;
+    // the whole column goes through the noise in one call
+    f32 xs[S*S], zs[S*S], noise[S*S];
+    for(i32 z=0; z<S; z++) for(i32 x=0; x<S; x++) {
+        xs[x+z*S] = (f32)(coords.x*S+x);
+        zs[x+z*S] = (f32)(coords.y*S+z);
+    }
+    Noise::warpedFbm2(xs, zs, noise, S*S, noiseSeed, heightNoise, warpNoise, warpAmount);
+    const ClimateRegion& region = *climateRegion(ClimateRegion::regionOf(coords));
+    u64 key = Random::chunkKey(seed, {coords.x, 0x7FFFFFFF, coords.y});
+    for(i32 i=0; i<S*S; i++) {
+        Climate c = region.at(coords.x*S + i%S, coords.y*S + i/S);
+        f32 flatness = std::clamp(0.5f + 0.5f*c.erosion, 0.0f, 1.0f);
+        f32 scale = heightScale * (1.0f - (1.0f - flatScale)*flatness);
+        column->heights[i] = (i32)std::floor(baseHeight + scale*noise[i]);
+        column->biomes[i] = biomeOf(c);
+        column->surface[i] = biomes[column->biomes[i]].surface;
+        // some bare patches in the grass
+        if(column->surface[i] == palette.grass && Random::unit(Random::at(key, i)) < 0.1f)
+            column->surface[i] = palette.dirt;
+        column->topSolid[i] = column->heights[i];
+    }
+    return columns.insert(column);
+}
+
+void WorldGenerator::generate(Chunk& chunk, ivec3 coords) {
+    constexpr i32 S = Chunk::CHUNKSIZE;
+    const ChunkColumn& column = *this->column({coords.x, coords.z});
+    u64 key = Random::chunkKey(seed, coords);
+    Chunk::Layout::forEach([&](ivec3 p, u32 i) {
+        i32 x = p.x, y = p.y + coords.y*S, z = p.z;
+        i32 height = column.heights[x+z*S];
+        // the counter is the position, not the storage index, so every layout gets the same blocks
+        f32 r = Random::unit(Random::at(key, x + (z + p.y*S)*S));
+        Chunk::blockID block = 0;
+        if(y < height-4)
+            block = r < 0.1 ? palette.cobblestone : palette.stone;
+        else if(y < height)
+            block = biomes[column.biomes[x+z*S]].subsurface;
+        else if(y == height)
+            block = column.surface[x+z*S];
+        chunk.setBlock(i, block);
+    });
+    carveCaves(chunk, coords);
+    chunk.compact();
+}
+
+void WorldGenerator::carveCaves(Chunk& chunk, ivec3 coords) {
+    constexpr i32 S = Chunk::CHUNKSIZE;
+    constexpr i32 SXZ = CAVE_STEP_XZ, SY = CAVE_STEP_Y;
+    const ChunkColumn& column = *this->column({coords.x, coords.z});
+    // the surface block is kept, so nothing above it is ever carved
+    i32 maxHeight = *std::max_element(column.heights, column.heights + S*S);
+    if(coords.y*S >= maxHeight)
+        return;
+    u32 caveSeed = noiseSeed + 0x400;
+    if(fullResolutionCaves) {
+        vector<f32> xs(Chunk::VOLUME), ys(Chunk::VOLUME), zs(Chunk::VOLUME), density(Chunk::VOLUME);
+        Chunk::Layout::forEach([&](ivec3 p, u32 i) {
+            xs[i] = (f32)(coords.x*S + p.x);
+            ys[i] = (f32)(coords.y*S + p.y);
+            zs[i] = (f32)(coords.z*S + p.z);
+        });
+        Noise::fbm3(xs.data(), ys.data(), zs.data(), density.data(), Chunk::VOLUME, caveSeed, caveNoise);
+        Chunk::Layout::forEach([&](ivec3 p, u32 i) {
+            if(density[i] > caveThreshold && coords.y*S + p.y < column.heights[p.x + p.z*S])
+                chunk.setBlock(i, 0);
+        });
+        return;
+    }
+    // the corners of the cells, x changing fastest then z then y
+    constexpr i32 NXZ = S/SXZ+1, NY = S/SY+1;
+    f32 xs[NXZ*NY*NXZ], ys[NXZ*NY*NXZ], zs[NXZ*NY*NXZ], density[NXZ*NY*NXZ];
+    for(i32 y=0; y<NY; y++) for(i32 z=0; z<NXZ; z++) for(i32 x=0; x<NXZ; x++) {
+        i32 i = x + (z + y*NXZ)*NXZ;
+        xs[i] = (f32)(coords.x*S + x*SXZ);
+        ys[i] = (f32)(coords.y*S + y*SY);
+        zs[i] = (f32)(coords.z*S + z*SXZ);
+    }
+    Noise::fbm3(xs, ys, zs, density, NXZ*NY*NXZ, caveSeed, caveNoise);
+    for(i32 cy=0; cy<S/SY; cy++) for(i32 cz=0; cz<S/SXZ; cz++) for(i32 cx=0; cx<S/SXZ; cx++) {
+        f32 d[8];
+        for(i32 c=0; c<8; c++)
+            d[c] = density[(cx + (c&1)) + ((cz + ((c>>1)&1)) + (cy + (c>>2))*NXZ)*NXZ];
+        f32 lo = *std::min_element(d, d+8), hi = *std::max_element(d, d+8);
+        // the interpolation stays between the corners, so these cells need no per block work
+        if(hi <= caveThreshold)
+            continue;
+        bool allAir = lo > caveThreshold;
+        for(i32 y=0; y<SY; y++) for(i32 z=0; z<SXZ; z++) for(i32 x=0; x<SXZ; x++) {
+            ivec3 p = ivec3(cx*SXZ + x, cy*SY + y, cz*SXZ + z);
+            if(coords.y*S + p.y >= column.heights[p.x + p.z*S])
+                continue;
+            if(!allAir) {
+                f32 fx = (f32)x/SXZ, fy = (f32)y/SY, fz = (f32)z/SXZ;
+                f32 d00 = d[0] + (d[1]-d[0])*fx, d10 = d[2] + (d[3]-d[2])*fx;
+                f32 d01 = d[4] + (d[5]-d[4])*fx, d11 = d[6] + (d[7]-d[6])*fx;
+                f32 d0 = d00 + (d10-d00)*fz, d1 = d01 + (d11-d01)*fz;
+                if(d0 + (d1-d0)*fy <= caveThreshold)
+                    continue;
+            }
+            chunk.setBlock(Chunk::indexOf(p), 0);
+        }
+    }
+}
+
+// trunks with a branch on top, the branch logs lie along their axis
+void WorldGenerator::features(ivec3 coords, vector<FeatureWrite>& out) {
+    constexpr i32 S = Chunk::CHUNKSIZE;
+    const ChunkColumn& column = *this->column({coords.x, coords.z});
+    u64 key = Random::chunkKey(seed ^ 0x7EE5ull, {coords.x, 0, coords.z});
+    u32 trees = biomes[column.biomes[S/2 + S/2*S]].trees;
+    for(u32 t=0; t<trees; t++) {
+        u64 r = Random::at(key, t);
+        i32 x = r % S, z = (r >> 8) % S;
+        i32 height = column.heights[x+z*S];
+        // rooted in the chunk of the block above the surface
+        if(((height+1) >> (i32)Chunk::SIZE_LOG2) != coords.y || column.surface[x+z*S] != palette.grass)
+            continue;
+        ivec3 base = ivec3(coords.x*S + x, height+1, coords.z*S + z);
+        i32 trunk = 4 + (r >> 16) % 4;
+        for(i32 y=0; y<trunk; y++)
+            out.push_back({ base + ivec3(0, y, 0), palette.logY });
+        u32 dir = (r >> 24) % 4;
+        u16 branch = directionToAxisAndSign[dir].x == 0 ? palette.logX : palette.logZ;
+        for(i32 b=1; b<=2; b++)
+            out.push_back({ base + ivec3(0, trunk-1, 0) + directionVector[dir]*b, branch });
+    }
+}
+
+void WorldGenerator::destroy() {
+    columns.clear();
+    climate.clear();
+}
+
+void GenerationPool::start(WorldGenerator& gen) {
+    generator = &gen;
+}
+
+void GenerationPool::submit(WorldChunk* wc, f32 cost) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued.push_back({ cost, submitted++, wc });
+        std::push_heap(queued.begin(), queued.end());
+        scheduled++;
+    }
+    Jobs::run("generate", [this]() { work(); });
+}
+
+bool GenerationPool::cancel(WorldChunk* wc) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(u32 i=0; i<queued.size(); i++)
+        if(queued[i].wc == wc) {
+            queued[i] = queued.back();
+            queued.pop_back();
+            std::make_heap(queued.begin(), queued.end());
+            return true;
+        }
+    return false;
+}
+
+void GenerationPool::collect(vector<WorldChunk*>& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.insert(out.end(), finished.begin(), finished.end());
+    finished.clear();
+}
+
+// the jobs of the pool are not kept, so these run jobs until the counters drop
+void GenerationPool::wait() {
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(queued.empty() && running == 0)
+                return;
+        }
+        if(!Jobs::help())
+            std::this_thread::yield();
+    }
+}
+
+void GenerationPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued.clear();
+    }
+    while(true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(scheduled == 0 && running == 0)
+                return;
+        }
+        if(!Jobs::help())
+            std::this_thread::yield();
+    }
+}
+
+void GenerationPool::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    scheduled--;
+    if(queued.empty())
+        return;
+    std::pop_heap(queued.begin(), queued.end());
+    WorldChunk* wc = queued.back().wc;
+    queued.pop_back();
+    running++;
+    lock.unlock();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    generator->generate(wc->chunk, wc->coords);
+    f64 seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+    lock.lock();
+    busySeconds += seconds;
+    running--;
+    finished.push_back(wc);
+}
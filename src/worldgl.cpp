@@ -0,0 +1,43 @@
+#include "world.hpp"
+#include "renderer.hpp"
+#include "resources.hpp"
+
+// The parts of the world that need the GL context, only the game links them
+
+void World::uploadMesh(VoxelMesh& mesh) {
+    mesh.makeObjects();
+}
+
+void World::draw(f32 time) const {
+
+    camera.pos = player->pos + 1.75f;
+    camera.angles = player->lookingAt;
+    camera.makeMatrices();
+
+    shader::bind(Registry::shaders["voxel"]);
+    camera.setMatrices();
+    gl::bindTexture(Registry::glTextures["atlas"].glid, 0);
+    shader::setTexture("tex", 0);
+    for(WorldChunk* wc : chunks) {
+        // chunks without uploaded geometry have no VAO to bind
+        if(wc->stage < STAGE_UPLOADED || !wc->mesh.hasObjects || wc->mesh.indicesCount == 0)
+            continue;
+        wc->mesh.updateUniforms();
+        wc->mesh.draw();
+    }
+
+    shader::bind(Registry::shaders["simple"]);
+    camera.setMatrices();
+    shader::setTexture("tex", 0);
+    for(WorldChunk* wc : chunks) for(auto& pp : wc->entities) {
+        u32 textureID = Registry::entities.items[pp.second->type].model->texture;
+        pp.second->updateMeshes(time);
+        gl::bindTexture(Registry::glTextures.items[textureID].glid, 0);
+        for(auto& mesh : pp.second->meshes) {
+            if(!mesh.hasObjects)
+                mesh.makeObjects();
+            mesh.updateUniforms();
+            mesh.draw();
+        }
+    }
+}
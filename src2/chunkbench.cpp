@@ -0,0 +1,111 @@
+#include "base.hpp"
+#include "jobs.hpp"
+#include "resources.hpp"
+#include "world.hpp"
+#include <chrono>
+
+// Measures chunk generation and meshing for the layout and size compiled in with CHUNK_LAYOUT and CHUNK_SIZE
+// usage: chunkbench [radius] [repeats]
+
+typedef std::chrono::steady_clock benchclock;
+
+f64 elapsedNs(benchclock::time_point start) {
+    return std::chrono::duration<f64, std::nano>(benchclock::now() - start).count();
+}
+
+int main(int argc, const char** argv) {
+    i32 radius = argc > 1 ? atoi(argv[1]) : 3;
+    u32 repeats = argc > 2 ? atoi(argv[2]) : 5;
+    if(radius <= 0 || repeats == 0) {
+        cerr << "Usage: chunkbench [radius] [repeats]\n";
+        return 1;
+    }
+
+    Registry::initHeadless();
+    Jobs::init();
+    WorldGenerator generator;
+    generator.init(1);
+
+    ChunkGrid grid;
+    benchclock::time_point start = benchclock::now();
+    for(i32 x=-radius; x<radius; x++) for(i32 z=-radius; z<radius; z++) for(i32 y=-1; y<2; y++) {
+        WorldChunk* wc = new WorldChunk({x, y, z});
+        generator.generate(wc->chunk, wc->coords);
+        grid.insert(wc);
+    }
+    f64 voxels = (f64)grid.size() * Chunk::VOLUME;
+    f64 generationNs = elapsedNs(start);
+
+    // the same chunks again on the jobs, the main thread helps while it waits
+    GenerationPool generation;
+    generation.start(generator);
+    start = benchclock::now();
+    for(WorldChunk* wc : grid)
+        generation.submit(wc);
+    generation.wait();
+    f64 parallelNs = elapsedNs(start);
+    vector<WorldChunk*> generated;
+    generation.collect(generated);
+    u32 threads = Jobs::threadCount() + 1;
+    generation.stop();
+
+    // the caves evaluated at every block instead of on the lattice
+    WorldGenerator fullGenerator;
+    fullGenerator.init(1);
+    fullGenerator.fullResolutionCaves = true;
+    u64 caveBlocks = 0, caveMismatches = 0;
+    f64 fullCavesNs = 0;
+    for(WorldChunk* wc : grid) {
+        Chunk* full = new Chunk();
+        start = benchclock::now();
+        fullGenerator.generate(*full, wc->coords);
+        fullCavesNs += elapsedNs(start);
+        for(u32 i=0; i<Chunk::VOLUME; i++) {
+            caveBlocks += full->getBlock(i) == 0;
+            caveMismatches += (full->getBlock(i) == 0) != (wc->chunk.getBlock(i) == 0);
+        }
+        delete full;
+    }
+    fullGenerator.destroy();
+
+    u64 vertices = 0;
+    u32 drawCalls = 0;
+    f64 meshingNs = 0;
+    for(u32 r=0; r<repeats; r++) {
+        vertices = 0;
+        drawCalls = 0;
+        for(WorldChunk* wc : grid) {
+            Chunk* neighbours[DIRECTION_COUNT];
+            for(u32 dir=0; dir<DIRECTION_COUNT; dir++)
+                neighbours[dir] = wc->neighbours[dir] ? &wc->neighbours[dir]->chunk : nullptr;
+            start = benchclock::now();
+            wc->chunk.makeVoxelMesh(wc->mesh, neighbours);
+            meshingNs += elapsedNs(start);
+            vertices += wc->mesh.vertices.size();
+            drawCalls += !wc->mesh.vertices.empty();
+            wc->mesh.vertices.clear();
+            wc->mesh.indices.clear();
+        }
+    }
+
+    start = benchclock::now();
+    for(WorldChunk* wc : grid)
+        wc->chunk.pack();
+    f64 packingNs = elapsedNs(start);
+    ChunkCompactor::Stats packing = ChunkCompactor().stats(grid);
+    start = benchclock::now();
+    for(WorldChunk* wc : grid)
+        wc->chunk.unpack();
+    f64 unpackingNs = elapsedNs(start);
+
+    cout << "layout " << Chunk::Layout::name << ", size " << Chunk::CHUNKSIZE << ", " << grid.size() << " chunks, " << vertices << " vertices, " << drawCalls << " draw calls\n";
+    cout << "  noise:      " << Noise::INSTRUCTION_SET << ", " << Noise::LANES << " lanes\n";
+    cout << "  generation: " << generationNs/voxels << " ns/voxel, " << parallelNs/voxels << " ns/voxel on " << threads << " threads\n";
+    cout << "  caves:      " << fullCavesNs/voxels << " ns/voxel at full resolution, " << 100.0*caveMismatches/voxels << "% of the blocks differ from the lattice, "
+         << 100.0*caveBlocks/voxels << "% air\n";
+    cout << "  meshing:    " << meshingNs/(voxels*repeats) << " ns/voxel\n";
+    cout << "  packing:    " << packing.packedChunks << "/" << packing.chunks << " chunks, " << packing.storedBytes/1024 << " KB for " << packing.unpackedBytes/1024 << " KB, "
+         << packingNs/grid.size()/1000 << " us/chunk to pack, " << unpackingNs/grid.size()/1000 << " us/chunk to unpack\n";
+    Jobs::destroy();
+    return 0;
+}
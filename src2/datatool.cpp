@@ -1,7 +1,13 @@
 #include "base.hpp"
 #include "data.hpp"
+#include "jobs.hpp"
+#include "resources.hpp"
+#include "storage.hpp"
+#include "world.hpp"
+#include <chrono>
 #include <fstream>
 #include <sstream>
+#include <thread>
 
 void help() {
     cerr << "Usage: datatool command [...args]\n";
@@ -11,6 +17,8 @@ void help() {
     cerr << "  t2b [input file] [output file] - converts between text data and binary data representations\n";
     cerr << "  b2t [input file] [output file] - converts between text data and binary data representations\n";
     cerr << "  bundle [input folder] [output file] - bundle a folder into a binary data file\n";
+    cerr << "  pregen [world folder] [radius] [square|circle] [threads] [seed] - generates the chunks around the origin and saves them, 0 threads uses every core\n";
+    cerr << "  chunkstress [readers] [seconds] [seed] - streams chunks while reader threads look them up in the chunk directory, fails if a reader gets a reclaimed chunk\n";
 }
 
 #define CHECK_ARGSIZE(x) if(args.size() != x) { cerr << "ERROR: Command " << __func__ << " requires " << x << " arguments.\n"; help(); return 1; }
@@ -131,6 +139,208 @@ i32 dejem(vector<string>& args) {
     return 0;
 }
 
+typedef std::chrono::steady_clock pregenclock;
+
+f64 secondsSince(pregenclock::time_point start) {
+    return std::chrono::duration<f64>(pregenclock::now() - start).count();
+}
+
+// the chunks go through the pipeline up to the light and are saved and released as soon as they are lit
+i32 pregen(vector<string>& args) {
+    if(args.size() < 2 || args.size() > 5) {
+        cerr << "ERROR: Command " << __func__ << " requires 2 to 5 arguments.\n";
+        help();
+        return 1;
+    }
+    string shape = args.size() > 2 ? args[2] : "square";
+    i32 radius = atoi(args[1].c_str());
+    u32 threads = args.size() > 3 ? atoi(args[3].c_str()) : 0;
+    u64 seed = args.size() > 4 ? strtoull(args[4].c_str(), nullptr, 10) : 1;
+    if(radius <= 0 || (shape != "square" && shape != "circle")) {
+        cerr << "ERROR: The radius must be positive and the shape square or circle.\n";
+        help();
+        return 1;
+    }
+    Registry::initHeadless();
+    WorldStorage storage;
+    if(!storage.open(args[0], World::verticalChunks()) || !storage.writeInfo(seed, Registry::blockStateNames()))
+        ERR_EXIT("Cannot write into folder " << args[0]);
+
+    World world;
+    world.seed = seed;
+    world.generator.init(seed);
+    Jobs::init(threads);
+    world.generation.start(world.generator);
+    world.pipeline.target = STAGE_LIT;
+    pregenclock::time_point start = pregenclock::now();
+    ivec2 rows = World::verticalChunks();
+    for(i32 x=-radius; x<radius; x++) for(i32 z=-radius; z<radius; z++) {
+        if(shape == "circle" && (x+0.5f)*(x+0.5f) + (z+0.5f)*(z+0.5f) > (f32)radius*radius)
+            continue;
+        for(i32 y=rows.x; y<rows.y; y++) {
+            WorldChunk* wc = world.pool.acquire({x, y, z});
+            world.chunks.insert(wc);
+            world.pipeline.add(world, wc);
+        }
+    }
+    u32 total = world.chunks.size();
+    threads = Jobs::threadCount() + 1;
+    cout << "Generating " << total << " chunks on " << threads << " threads into " << args[0] << "\n";
+
+    vector<WorldChunk*> lit;
+    vector<vector<u8>> bytes;
+    f64 serializeSeconds = 0, writeSeconds = 0;
+    u32 saved = 0;
+    while(world.chunks.size() > 0) {
+        world.pipeline.update(world, true);
+        lit.clear();
+        for(WorldChunk* wc : world.chunks)
+            if(wc->stage == STAGE_LIT)
+                lit.push_back(wc);
+        // the chunks are serialized on the jobs and written in order from here
+        pregenclock::time_point stageStart = pregenclock::now();
+        bytes.resize(std::max(bytes.size(), lit.size()));
+        Jobs::parallelFor("serialize chunk", lit.size(), 4, [&](u32 i) {
+            bytes[i].clear();
+            lit[i]->chunk.pack();
+            lit[i]->chunk.serialize(bytes[i]);
+        });
+        serializeSeconds += secondsSince(stageStart);
+        for(u32 i=0; i<lit.size(); i++) {
+            WorldChunk* wc = lit[i];
+            stageStart = pregenclock::now();
+            if(!storage.writeChunk(wc->coords, bytes[i], wc->chunk.isPacked() ? COMPRESSION_PACKED : COMPRESSION_NONE))
+                ERR_EXIT("Cannot write chunk " << wc->coords.x << " " << wc->coords.y << " " << wc->coords.z << " into " << storage.regionPath(RegionFile::regionOf(wc->coords)));
+            writeSeconds += secondsSince(stageStart);
+            world.pipeline.remove(wc);
+            world.chunks.release(world.chunks.remove(wc->coords), world.pool);
+            if(++saved % 1024 == 0)
+                cout << "  " << saved << "/" << total << " chunks\n";
+        }
+        world.chunks.collect();
+        // the jobs are still generating, this thread helps with them
+        if(lit.empty() && !Jobs::help())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    f64 seconds = secondsSince(start);
+    world.generation.stop();
+    world.chunks.directory.epochs.drain();
+
+    u64 fileBytes = 0;
+    for(const auto& [coords, file] : storage.regions)
+        fileBytes += file ? file->usedBytes() : 0;
+    cout << "Saved " << saved << " chunks, " << storage.bytesWritten/1024 << " KB in " << seconds << " s\n";
+    cout << "  " << storage.regions.size() << " region files, " << fileBytes/1024 << " KB on disk\n";
+    cout << "  " << saved/seconds << " chunks/s, " << storage.bytesWritten/seconds/(1024*1024) << " MB/s\n";
+    cout << "  terrain:   " << world.generation.busySeconds << " s over " << threads << " threads\n";
+    cout << "  features:  " << world.pipeline.stageSeconds[STAGE_FEATURES] << " s\n";
+    cout << "  light:     " << world.pipeline.stageSeconds[STAGE_LIT] << " s\n";
+    cout << "  serialize: " << serializeSeconds << " s\n";
+    cout << "  write:     " << writeSeconds << " s\n";
+    for(const auto& [name, task] : Jobs::stats())
+        cout << "  task " << name << ": " << task.count << " runs, " << task.totalSeconds*1000/task.count << " ms average, " << task.maxSeconds*1000 << " ms max\n";
+    storage.close();
+    Jobs::destroy();
+    world.generator.destroy();
+    world.pool.destroy();
+    return 0;
+}
+
+// the center walks along x so chunks load in front and unload behind, while the reader threads
+// look up the chunks around it in the directory and check them again before leaving the guard,
+// a chunk with other coordinates than the ones looked up was reclaimed and handed out again too early
+i32 chunkstress(vector<string>& args) {
+    if(args.size() > 3) {
+        cerr << "ERROR: Command " << __func__ << " requires 0 to 3 arguments.\n";
+        help();
+        return 1;
+    }
+    u32 readers = args.size() > 0 ? atoi(args[0].c_str()) : 4;
+    f64 duration = args.size() > 1 ? atof(args[1].c_str()) : 5;
+    u64 seed = args.size() > 2 ? strtoull(args[2].c_str(), nullptr, 10) : 1;
+    if(readers == 0 || duration <= 0) {
+        cerr << "ERROR: The readers and the seconds must be positive.\n";
+        help();
+        return 1;
+    }
+
+    Registry::initHeadless();
+    Jobs::init();
+    World world;
+    world.seed = seed;
+    world.generator.init(seed);
+    world.generation.start(world.generator);
+    world.pipeline.target = STAGE_LIT;
+    ivec2 rows = World::verticalChunks();
+    world.centerChunk = { 0, rows.x, 0 };
+    world.chunks.recenter(world.centerChunk);
+
+    std::atomic<bool> stopping { false };
+    std::atomic<i32> centerX { 0 };
+    std::atomic<u64> lookups { 0 }, hits { 0 }, errors { 0 };
+    i32 reach = world.streamer.unloadRadius + 2;
+    vector<std::thread> threads;
+    for(u32 t=0; t<readers; t++)
+        threads.emplace_back([&, t]() {
+            u64 key = Random::mix(seed + t), counter = 0;
+            u64 n = 0, found = 0, wrong = 0;
+            vector<pair<WorldChunk*, u32>> seen;
+            while(!stopping) {
+                Epochs::Guard guard(world.chunks.directory.epochs);
+                seen.clear();
+                for(u32 i=0; i<4096; i++) {
+                    u64 r = Random::at(key, counter++);
+                    ivec3 coords = {
+                        centerX + (i32)(r % (2*reach+1)) - reach,
+                        rows.x + (i32)((r >> 16) % (rows.y - rows.x)),
+                        (i32)((r >> 32) % (2*reach+1)) - reach
+                    };
+                    WorldChunk* wc = world.chunks.directory.find(guard, coords);
+                    n++;
+                    if(!wc)
+                        continue;
+                    found++;
+                    seen.push_back({ wc, wc->releases.load(std::memory_order_acquire) });
+                }
+                // checked again at the end so that the chunks are held across updates of the main thread,
+                // the pool counts every release so a reclaimed chunk shows even when it is handed out at the same coordinates
+                for(const auto& [wc, releases] : seen)
+                    if(wc->releases.load(std::memory_order_acquire) != releases)
+                        wrong++;
+            }
+            lookups += n;
+            hits += found;
+            errors += wrong;
+        });
+
+    pregenclock::time_point start = pregenclock::now();
+    u32 updates = 0;
+    while(secondsSince(start) < duration) {
+        // 4 chunks per second
+        world.centerChunk.x = (i32)(secondsSince(start)*4);
+        centerX = world.centerChunk.x;
+        world.chunks.recenter(world.centerChunk);
+        world.focus.update(vec3(world.centerChunk)*(f32)Chunk::CHUNKSIZE, vec3(4*Chunk::CHUNKSIZE, 0, 0), vec3(0));
+        world.updateRenderChunks();
+        world.pipeline.update(world);
+        updates++;
+        if(!Jobs::help())
+            std::this_thread::yield();
+    }
+    stopping = true;
+    for(std::thread& thread : threads)
+        thread.join();
+    f64 seconds = secondsSince(start);
+
+    cout << "Streamed " << world.centerChunk.x << " chunks along x in " << updates << " updates, " << world.streamer.stats.loaded << " chunks loaded, "
+         << world.streamer.stats.unloaded << " unloaded, " << world.chunks.directory.epochs.freed << " reclaimed\n";
+    cout << "  " << readers << " readers: " << lookups << " lookups, " << lookups/seconds/readers/1e6 << " M/s per reader, " << 100.0*hits/std::max<u64>(1, lookups) << "% found\n";
+    cout << "  " << errors << " lookups returned a chunk that was reclaimed while it was held\n";
+    world.destroy();
+    Jobs::destroy();
+    return errors == 0 ? 0 : 1;
+}
+
 int main(int argc, const char** argv) {
     vector<string> args;
     for(i32 i=1; i<argc; i++)
@@ -147,6 +357,8 @@ int main(int argc, const char** argv) {
     CHECK(b2t)
     CHECK(bundle)
     CHECK(dejem)
+    CHECK(pregen)
+    CHECK(chunkstress)
     #undef CHECK
     
     cerr << "ERROR: Program requires a command.\n"; 